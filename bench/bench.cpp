@@ -0,0 +1,322 @@
+#include "instruction.hpp"
+#include "lexer.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include "vm.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// Times the lex, parse, optimize and execute phases of each workload
+// separately, over repeated runs, and reports the median and 95th
+// percentile of each. Execution also reports how many decoded
+// instructions it dispatched per second.
+//
+// Usage: quickchat-bench [--runs N] [--scale MB] [--jit] [path...]
+// Without paths it runs the programs in bench/ plus a few generated ones.
+
+static const char* INPUT_PATH = "quickchat-bench.input";
+static const size_t INPUT_SIZE = 4 << 20;
+
+struct Workload
+{
+    std::string name;
+    std::string source;
+};
+
+// Swallows the programs' output so the terminal doesn't end up in the
+// measurement.
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+struct Phase
+{
+    std::string name;
+    std::vector<double> times;
+
+    double percentile(double p) const
+    {
+        auto sorted = times;
+        std::sort(sorted.begin(), sorted.end());
+        auto rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+        return sorted[std::max<size_t>(rank, 1) - 1];
+    }
+};
+
+static double timeOnce(const std::function<void()>& body)
+{
+    auto start = std::chrono::steady_clock::now();
+    body();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static std::string readFile(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open " << path << std::endl;
+        exit(74);
+    }
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+static std::string line(const std::string& name, const std::string& command)
+{
+    return name + ": " + command + "\n";
+}
+
+// Megabytes of commands with no loops at all, spread over eight tapes.
+// Pointers only ever step one cell right and back, so it can't fail.
+static std::string straightLine(size_t size)
+{
+    static const char* names[] = { "A", "B", "C", "D", "E", "F", "G", "H" };
+    std::mt19937 random(1);
+    std::string source;
+    for (auto name : names)
+    {
+        source += std::string(name) + " joined the match\n";
+    }
+
+    while (source.size() < size)
+    {
+        std::string name = names[random() % 8];
+        switch (random() % 4)
+        {
+            case 0:
+                source += line(name, "I got it!") + line(name, "Nice shot!") + line(name, "Defending...");
+                break;
+            case 1:
+                source += line(name, "Nice shot!");
+                break;
+            case 2:
+                source += line(name, "No problem.");
+                break;
+            default:
+                source += line(name, "Nice shot!") + line(name, "Nice shot!") + line(name, "No problem.");
+                break;
+        }
+    }
+    return source;
+}
+
+// Megabytes of short loops nested up to eight deep. Counters step by two
+// from an even start so the optimizer can't turn them into arithmetic.
+static std::string manyLoops(size_t size)
+{
+    static const char* names[] = { "LA", "LB", "LC", "LD", "LE", "LF", "LG", "LH", "WORK" };
+    std::mt19937 random(2);
+    std::string source;
+    for (auto name : names)
+    {
+        source += std::string(name) + " joined the match\n";
+    }
+
+    std::function<void(int)> loop = [&](int depth)
+    {
+        auto name = names[depth];
+        auto trips = 1 + random() % 3;
+        for (unsigned i = 0; i < trips * 2; i++) source += line(name, "Nice shot!");
+        source += line(name, "Take the shot!");
+        source += line("WORK", "Nice shot!");
+        if (depth < 7 && random() % 2 == 0) loop(depth + 1);
+        source += line("WORK", "Nice shot!");
+        source += line(name, "No problem.") + line(name, "No problem.");
+        source += line(name, "What a save!");
+    };
+
+    while (source.size() < size)
+    {
+        loop(0);
+    }
+    return source;
+}
+
+static void writeInput()
+{
+    std::mt19937 random(3);
+    std::string input(INPUT_SIZE, '\0');
+    for (auto& c : input)
+    {
+        // 255 is what EOF reads as, keep it out of the data.
+        c = static_cast<char>(random() % 255);
+    }
+    std::ofstream(INPUT_PATH, std::ios::binary).write(input.data(), input.size());
+}
+
+static void openInput()
+{
+    if (freopen(INPUT_PATH, "rb", stdin) == nullptr)
+    {
+        std::cerr << "Failed to open " << INPUT_PATH << std::endl;
+        exit(74);
+    }
+}
+
+static void report(const Phase& phase, const std::string& extra)
+{
+    printf("  %-10s median %10.3f ms   p95 %10.3f ms%s\n",
+        phase.name.c_str(), phase.percentile(0.5), phase.percentile(0.95), extra.c_str());
+}
+
+static void bench(const Workload& workload, int runs, bool jit)
+{
+    Phase lex { "lex", {} };
+    Phase parse { "parse", {} };
+    Phase optimize { "optimize", {} };
+    Phase execute { "execute", {} };
+
+    auto parsed = Instructions();
+    for (int i = 0; i < runs; i++)
+    {
+        lex.times.push_back(timeOnce([&]
+        {
+            auto lexer = Lexer(workload.source);
+            while (lexer.scanToken().type != TokenType::_EOF);
+        }));
+
+        // The parser pulls tokens as it goes, so this includes lexing.
+        parsed = Instructions();
+        bool compiled = true;
+        parse.times.push_back(timeOnce([&]
+        {
+            compiled = Parser(workload.source, parsed).compile();
+        }));
+        if (!compiled)
+        {
+            printf("%s: compile error\n", workload.name.c_str());
+            return;
+        }
+    }
+
+    auto optimized = parsed;
+    for (int i = 0; i < runs; i++)
+    {
+        optimized = parsed;
+        optimize.times.push_back(timeOnce([&]
+        {
+            Optimizer(optimized, DEFAULT_CELL_BITS).optimize(0);
+        }));
+    }
+
+    NullBuffer null;
+    auto stdoutBuffer = std::cout.rdbuf(&null);
+
+    // One profiled run up front, which doubles as a warm-up.
+    auto counter = VM(optimized);
+    counter.setProfiling(true);
+    openInput();
+    auto result = counter.run();
+    uint64_t instructionCount = 0;
+    for (auto hits : counter.getProfile().hits)
+    {
+        instructionCount += hits;
+    }
+
+    for (int i = 0; result == InterpretResult::OK && i < runs; i++)
+    {
+        openInput();
+        execute.times.push_back(timeOnce([&]
+        {
+            auto vm = VM(optimized);
+            vm.setJit(jit);
+            vm.run();
+        }));
+    }
+
+    std::cout.rdbuf(stdoutBuffer);
+
+    printf("%s (%.1f KB of source, %llu instructions executed)\n", workload.name.c_str(),
+        workload.source.size() / 1024.0, static_cast<unsigned long long>(instructionCount));
+    report(lex, "");
+    report(parse, "");
+    report(optimize, "");
+    if (result != InterpretResult::OK)
+    {
+        printf("  execute    runtime error\n");
+        return;
+    }
+
+    auto perSecond = instructionCount / (execute.percentile(0.5) / 1000.0);
+    char rate[64];
+    snprintf(rate, sizeof(rate), "   %.1fM instructions/s", perSecond / 1e6);
+    report(execute, rate);
+}
+
+static void usage()
+{
+    std::cerr << "Usage: quickchat-bench [--runs N] [--scale MB] [--jit] [path...]" << std::endl;
+    exit(64);
+}
+
+int main(int argc, const char* argv[])
+{
+    int runs = 10;
+    size_t scale = 4;
+    bool jit = false;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++)
+    {
+        auto arg = std::string(argv[i]);
+        if (arg == "--runs" && i + 1 < argc)
+        {
+            runs = atoi(argv[++i]);
+            if (runs <= 0) usage();
+        }
+        else if (arg == "--scale" && i + 1 < argc)
+        {
+            scale = strtoull(argv[++i], nullptr, 10);
+            if (scale == 0) usage();
+        }
+        else if (arg == "--jit")
+        {
+            jit = true;
+        }
+        else if (arg.rfind("--", 0) != 0)
+        {
+            paths.push_back(arg);
+        }
+        else
+        {
+            usage();
+        }
+    }
+
+    std::vector<Workload> workloads;
+    if (paths.empty())
+    {
+        for (auto name : { "nested_loops.qc", "great_pass.qc", "output.qc", "input.qc" })
+        {
+            workloads.push_back({ name, readFile(std::string(QUICKCHAT_BENCH_DIR) + "/" + name) });
+        }
+        workloads.push_back({ "straight_line (generated)", straightLine(scale << 20) });
+        workloads.push_back({ "many_loops (generated)", manyLoops(scale << 20) });
+    }
+    for (auto& path : paths)
+    {
+        workloads.push_back({ path, readFile(path) });
+    }
+
+    writeInput();
+    for (auto& workload : workloads)
+    {
+        bench(workload, runs, jit);
+    }
+    remove(INPUT_PATH);
+}
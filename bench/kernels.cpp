@@ -0,0 +1,124 @@
+#include "tape_kernels.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Times every tape kernel the CPU can run against the plain loops SCAN
+// used to run (the "scalar" set), one scan at a time over a tape whose
+// cells are all nonzero but the one it stops at, so every scan walks the
+// whole tape. Reports the median and 95th percentile of each, and how
+// many times faster than the plain loop that is. Walking right one cell
+// at a time was already memchr, so every set still uses that.
+//
+// Usage: quickchat-kernel-bench [--runs N] [--cells N]
+
+static const size_t STRIDES[] = { 1, 2, 3, 4, 8, 16 };
+
+static double percentile(std::vector<double> times, double p)
+{
+    std::sort(times.begin(), times.end());
+    auto rank = static_cast<size_t>(std::ceil(p * times.size()));
+    return times[std::max<size_t>(rank, 1) - 1];
+}
+
+// Keeps the scans from being optimized away.
+static volatile size_t sink;
+
+static std::vector<double> timeRuns(int runs, size_t (*scan)())
+{
+    std::vector<double> times;
+    sink = scan();
+    for (int i = 0; i < runs; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        sink = scan();
+        auto end = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+    }
+    return times;
+}
+
+// What the scans run over. Plain function pointers are all timeRuns()
+// takes, so the scan to time is set up here.
+static std::vector<char> cells;
+static const TapeKernels* kernels;
+static size_t stride;
+
+static size_t scanRight()
+{
+    return kernels->scanRight(cells.data(), 0, cells.size(), stride);
+}
+
+static size_t scanLeft()
+{
+    size_t found = 0;
+    kernels->scanLeft(cells.data(), cells.size() - 1, stride, found);
+    return found;
+}
+
+static void bench(const char* name, size_t (*scan)(), bool right, int runs)
+{
+    auto sets = supportedTapeKernels();
+    for (auto s : STRIDES)
+    {
+        stride = s;
+
+        // Nonzero everywhere but the last cell the scan would look at
+        // before running off the tape.
+        std::fill(cells.begin(), cells.end(), 1);
+        auto steps = (cells.size() - 1) / stride;
+        cells[right ? steps * stride : cells.size() - 1 - steps * stride] = 0;
+
+        printf("%s, stride %zu (%zu cells)\n", name, stride, cells.size());
+        double plain = 0;
+        for (auto set : sets)
+        {
+            kernels = set;
+            auto times = timeRuns(runs, scan);
+            auto median = percentile(times, 0.5);
+            if (plain == 0) plain = median;
+            printf("  %-10s median %10.3f us   p95 %10.3f us   %5.1fx\n",
+                set->name, median, percentile(times, 0.95), plain / median);
+        }
+    }
+}
+
+static void usage()
+{
+    std::cerr << "Usage: quickchat-kernel-bench [--runs N] [--cells N]" << std::endl;
+    exit(64);
+}
+
+int main(int argc, const char* argv[])
+{
+    int runs = 25;
+    size_t count = 1 << 20;
+
+    for (int i = 1; i < argc; i++)
+    {
+        auto arg = std::string(argv[i]);
+        if (arg == "--runs" && i + 1 < argc)
+        {
+            runs = atoi(argv[++i]);
+            if (runs <= 0) usage();
+        }
+        else if (arg == "--cells" && i + 1 < argc)
+        {
+            count = strtoull(argv[++i], nullptr, 10);
+            if (count == 0) usage();
+        }
+        else
+        {
+            usage();
+        }
+    }
+
+    cells.resize(count);
+    bench("scanRight", scanRight, true, runs);
+    bench("scanLeft", scanLeft, false, runs);
+}
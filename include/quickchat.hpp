@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// The embedding API, and the only header libquickchat installs. Nothing in
+// here exposes the interpreter's own types, so they can change without
+// breaking anyone built against it.
+
+enum class RunResult
+{
+    OK,
+    COMPILE_ERROR,
+    RUNTIME_ERROR,
+    LIMIT_REACHED,
+    SUSPENDED,
+};
+
+struct ProgramData;
+struct ExecutionData;
+
+// A script compiled and optimized once. Programs are immutable, cheap to
+// copy, and safe to run from any number of threads at the same time.
+class Program
+{
+private:
+    std::shared_ptr<const ProgramData> data;
+
+    Program(std::shared_ptr<const ProgramData> data): data(std::move(data)) {};
+    friend class Execution;
+public:
+    static Program compile(std::string_view source);
+
+    // False if the source had errors; errors() says what they were.
+    bool valid() const;
+    const std::string& errors() const;
+
+    size_t tapeCount() const;
+    const std::string& tapeName(size_t slot) const;
+    size_t codeSize() const;
+};
+
+// One run of a Program with its own tapes and streams. Output goes to the
+// callback if there is one, otherwise it is collected for output(). Input
+// comes from the callback or buffer given, and is at EOF without either.
+class Execution
+{
+private:
+    std::unique_ptr<ExecutionData> data;
+public:
+    // Called with each block of output, and asked to fill up to 'size'
+    // bytes of input, returning how many it did; 0 means EOF.
+    using OutputCallback = std::function<void(const char* bytes, size_t size)>;
+    using InputCallback = std::function<size_t(char* bytes, size_t size)>;
+
+    explicit Execution(const Program& program);
+    ~Execution();
+    Execution(Execution&& other) noexcept;
+    Execution& operator=(Execution&& other) noexcept;
+
+    // Cells each tape may grow to. Every tape has at least the one it
+    // starts on, so 0 counts as 1.
+    void setTapeLimit(size_t cells);
+    void setJit(bool enabled);
+
+    // Limits on each call to run(). Both are checked where a loop goes
+    // round again, so a run can go over by about one loop body. Reaching
+    // one is LIMIT_REACHED, an error naming the loop, unless the
+    // Execution is resumable: then run() returns SUSPENDED and the next
+    // call carries on from there, which lets a host take turns between
+    // many scripts on one thread. Either limit makes it interpret.
+    void setFuel(uint64_t instructions);
+    void setTimeLimit(std::chrono::milliseconds limit);
+    void setResumable(bool enabled);
+    void setOutput(OutputCallback callback);
+    void setInput(InputCallback callback);
+    void setInput(std::string buffer);
+
+    // Runs the program to the end, or up to its first runtime error. An
+    // invalid Program gives COMPILE_ERROR without running anything. Running
+    // again after anything but SUSPENDED starts over on blank tapes,
+    // reusing the last run's memory, so keeping an Execution around is
+    // cheaper than making a new one.
+    RunResult run();
+
+    const std::string& output() const;
+    const std::string& errors() const;
+};
@@ -0,0 +1,196 @@
+#include "analyzer.hpp"
+#include <algorithm>
+
+static int64_t moveOf(const DecodedInstruction& instruction)
+{
+    switch (instruction.opcode)
+    {
+        case OpCode::INCPTR: return 1;
+        case OpCode::DECPTR: return -1;
+        case OpCode::MOVE: return instruction.operand;
+        case OpCode::SCAN:
+        case OpCode::DEFINE_NAME:
+        case OpCode::DELETE_NAME:
+            return UNKNOWN_MOVE;
+        default:
+            return 0;
+    }
+}
+
+// Works out each loop's effect from running totals of every tape's moves:
+// a tape's effect is how far its total got between BEGIN and END, unless
+// something unknowable happened to it in between. A tape is only noted in
+// a loop once something in it touches the tape. A nested loop runs an
+// unknown number of times, so any tape it drifts counts as unknowable for
+// the loops around it. False if the loops don't pair up, which only code
+// left behind by a failed compile can do.
+bool Analyzer::summarizeLoops(size_t from)
+{
+    struct Noted
+    {
+        uint16_t tape;
+        int64_t total;
+        uint32_t unknowns;
+    };
+
+    std::vector<int64_t> totals(ranges.size());
+    std::vector<uint32_t> unknowns(ranges.size());
+    std::vector<int> innermost(ranges.size(), -1);    // Deepest open loop the tape is noted in.
+    std::vector<size_t> open;
+    std::vector<std::vector<Noted>> noted;
+
+    for (size_t i = from; i < program.size(); i++)
+    {
+        auto& instruction = program[i];
+        if (instruction.opcode == OpCode::BEGIN)
+        {
+            open.push_back(loops.size());
+            loops.push_back({ i, 0 });
+            if (noted.size() < open.size()) noted.emplace_back();
+            continue;
+        }
+
+        if (instruction.opcode == OpCode::END)
+        {
+            if (open.empty()) return false;
+            auto depth = open.size() - 1;
+            auto& loop = loops[open.back()];
+            auto begin = loop.first;
+            if (program[begin].jump != i + 1 || instruction.jump != begin + 1) return false;
+
+            loop = { effects.size(), noted[depth].size() };
+            for (auto& note : noted[depth])
+            {
+                auto move = unknowns[note.tape] != note.unknowns ? UNKNOWN_MOVE : totals[note.tape] - note.total;
+                effects.push_back({ note.tape, move });
+                if (move != 0) unknowns[note.tape]++;
+                innermost[note.tape] = static_cast<int>(depth) - 1;
+            }
+            noted[depth].clear();
+            open.pop_back();
+            continue;
+        }
+
+        auto move = moveOf(instruction);
+        if (move == 0) continue;
+
+        auto tape = instruction.tape;
+        for (auto depth = static_cast<int>(open.size()) - 1; depth > innermost[tape]; depth--)
+        {
+            noted[depth].push_back({ tape, totals[tape], unknowns[tape] });
+        }
+        innermost[tape] = static_cast<int>(open.size()) - 1;
+
+        if (move == UNKNOWN_MOVE) unknowns[tape]++;
+        else totals[tape] += move;
+    }
+    return open.empty();
+}
+
+// A move that succeeded leaves the tape with at least one cell past the
+// lowest place the pointer could be.
+static void moveBy(PointerRange& range, int64_t move)
+{
+    if (move > 0)
+    {
+        range.lo += move;
+        if (range.hi != UNBOUNDED) range.hi += move;
+        range.cells = std::max(range.cells, range.lo + 1);
+    }
+    else
+    {
+        size_t back = -move;
+        range.lo = range.lo > back ? range.lo - back : 0;
+        if (range.hi != UNBOUNDED) range.hi = range.hi > back ? range.hi - back : 0;
+    }
+}
+
+static bool fits(const PointerRange& range, size_t ahead)
+{
+    return range.hi != UNBOUNDED && range.hi + ahead < range.cells;
+}
+
+void Analyzer::step(DecodedInstruction& instruction)
+{
+    auto& range = ranges[instruction.tape];
+    switch (instruction.opcode)
+    {
+        case OpCode::INCPTR:
+            if (fits(range, 1)) instruction.opcode = OpCode::INCPTR_UNCHECKED;
+            moveBy(range, 1);
+            break;
+        case OpCode::DECPTR:
+            if (range.lo >= 1) instruction.opcode = OpCode::DECPTR_UNCHECKED;
+            moveBy(range, -1);
+            break;
+        case OpCode::MOVE:
+            if (instruction.operand > 0 ? fits(range, instruction.operand) : range.lo >= static_cast<size_t>(-instruction.operand))
+            {
+                instruction.opcode = OpCode::MOVE_UNCHECKED;
+            }
+            moveBy(range, instruction.operand);
+            break;
+        case OpCode::SCAN:
+            if (instruction.operand > 0) range.hi = UNBOUNDED;
+            else range.lo = 0;
+            break;
+        case OpCode::DEFINE_NAME:
+            range = { 0, 0, joinedCells };
+            break;
+        case OpCode::DELETE_NAME:
+            // Parked on its one cell.
+            range = { 0, 0, 1 };
+            break;
+        case OpCode::COPY_FROM:
+            // With a tape for every value the cell can hold, every copy
+            // finds its tape.
+            if (cellBits < 32 && ranges.size() >= static_cast<size_t>(1) << cellBits) instruction.opcode = OpCode::COPY_FROM_UNCHECKED;
+            break;
+        case OpCode::MUL_ADD:
+            if (fits(ranges[instruction.other], instruction.offset)) instruction.opcode = OpCode::MUL_ADD_UNCHECKED;
+            break;
+        default:
+            break;
+    }
+}
+
+// A loop is entered with the ranges widened by its effect, which is then
+// what they are at the head of every trip, and on the way out.
+void Analyzer::analyze(size_t from)
+{
+    if (!summarizeLoops(from)) return;
+
+    std::vector<size_t> open;
+    std::vector<std::pair<uint16_t, PointerRange>> heads;
+    size_t next = 0;
+
+    for (size_t i = from; i < program.size(); i++)
+    {
+        auto& instruction = program[i];
+        if (instruction.opcode == OpCode::BEGIN)
+        {
+            auto [first, count] = loops[next++];
+            open.push_back(heads.size());
+            for (auto effect = effects.begin() + first; effect != effects.begin() + first + count; effect++)
+            {
+                auto& range = ranges[effect->tape];
+                if (effect->move == UNKNOWN_MOVE || effect->move < 0) range.lo = 0;
+                if (effect->move == UNKNOWN_MOVE || effect->move > 0) range.hi = UNBOUNDED;
+                heads.push_back({ effect->tape, range });
+            }
+        }
+        else if (instruction.opcode == OpCode::END)
+        {
+            for (auto head = heads.begin() + open.back(); head != heads.end(); head++)
+            {
+                ranges[head->first] = head->second;
+            }
+            heads.resize(open.back());
+            open.pop_back();
+        }
+        else
+        {
+            step(instruction);
+        }
+    }
+}
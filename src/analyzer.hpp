@@ -0,0 +1,57 @@
+#pragma once
+
+#include "instruction.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+const size_t UNBOUNDED = SIZE_MAX;
+
+// What is known about a tape at one point in the program: its pointer is
+// somewhere in [lo, hi], and it has at least 'cells' cells.
+struct PointerRange
+{
+    size_t lo;
+    size_t hi;
+    size_t cells;
+};
+
+// Net pointer movement of one trip through a loop body on a tape it
+// touches. Scans and joins make it unknowable.
+struct LoopEffect
+{
+    uint16_t tape;
+    int64_t move;
+};
+
+const int64_t UNKNOWN_MOVE = INT64_MIN;
+
+// Abstract interpretation of a decoded program over pointer ranges. Every
+// pointer move or copy whose check provably can't fail is swapped for its
+// unchecked variant; anything it can't prove keeps its check, and with it
+// the same error at the same place.
+//
+// Loops are summarized before the main pass, so it stays a single walk: a
+// tape the body leaves where it found it keeps its range at the loop head,
+// and one it drifts is widened in the direction it drifts.
+class Analyzer
+{
+private:
+    std::vector<DecodedInstruction>& program;
+    std::vector<PointerRange> ranges;
+    size_t joinedCells;
+    int cellBits;
+    std::vector<LoopEffect> effects;
+    std::vector<std::pair<size_t, size_t>> loops;   // Span in effects of each loop, in BEGIN order.
+
+    bool summarizeLoops(size_t from);
+    void step(DecodedInstruction& instruction);
+public:
+    // 'entry' has the state of every tape as the code at 'from' starts;
+    // a tape that joins has at least 'joinedCells' cells, and cells are
+    // 'cellBits' wide.
+    Analyzer(std::vector<DecodedInstruction>& program, std::vector<PointerRange> entry, size_t joinedCells, int cellBits)
+        : program(program), ranges(std::move(entry)), joinedCells(joinedCells), cellBits(cellBits) {};
+
+    void analyze(size_t from);
+};
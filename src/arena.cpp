@@ -0,0 +1,86 @@
+#include "arena.hpp"
+#include <cstring>
+#include <new>
+
+TapeArena::Cells TapeArena::zeroed(size_t bytes)
+{
+    auto start = static_cast<char*>(calloc(bytes, 1));
+    if (start == nullptr && bytes != 0) throw std::bad_alloc();
+    return Cells(start);
+}
+
+// Like reserve(), only takes effect while nothing is handed out.
+void TapeArena::setCellSize(size_t bytes)
+{
+    if (used > 0 || !overflow.empty() || bytes == width) return;
+    block.reset();
+    capacity = 0;
+    width = bytes;
+}
+
+// Only takes effect while nothing is handed out, since the block can't
+// move under the tapes using it.
+void TapeArena::reserve(size_t cells)
+{
+    if (used > 0 || !overflow.empty() || cells <= capacity) return;
+    block = zeroed(cells * width);
+    capacity = cells;
+}
+
+char* TapeArena::allocate(size_t cells)
+{
+    if (capacity - used >= cells)
+    {
+        auto start = block.get() + used * width;
+        used += cells;
+        return start;
+    }
+
+    overflow.push_back(zeroed(cells * width));
+    overflowed += cells;
+    return overflow.back().get();
+}
+
+// At least 'cells' zeroed cells for a joining tape, reusing the most
+// recently released ones if they are big enough. 'cells' is set to how
+// many it got.
+char* TapeArena::acquire(size_t& cells)
+{
+    while (!released.empty())
+    {
+        auto [start, size] = released.back();
+        released.pop_back();
+        if (size < cells) continue;
+        cells = size;
+        return start;
+    }
+    return allocate(cells);
+}
+
+void TapeArena::release(char* cells, size_t size)
+{
+    memset(cells, 0, size * width);
+    released.push_back({ cells, size });
+}
+
+// Everything handed out may have been written, and nothing else can have
+// been, so that is all there is to zero. A run that overflowed swaps the
+// lot for one block big enough to hold it next time.
+void TapeArena::reset()
+{
+    if (!overflow.empty())
+    {
+        auto cells = used + overflowed;
+        overflow.clear();
+        overflowed = 0;
+        block.reset();
+        block = zeroed(cells * width);
+        capacity = cells;
+    }
+    else
+    {
+        memset(block.get(), 0, used * width);
+    }
+    used = 0;
+    released.clear();
+}
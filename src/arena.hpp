@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Zeroed cell storage for all of a VM's tapes, handed out from one block.
+// Sizes are counted in cells of cellSize() bytes each.
+// A tape whose player leaves gives its cells back with release(), for the
+// next one to join to take over; otherwise nothing is given back until
+// reset() zeroes what was handed out and starts again from the front, so
+// a VM that is run over and over stops allocating once the block holds a
+// whole run.
+class TapeArena
+{
+private:
+    // From calloc rather than new[], so cells that are reserved but never
+    // reached aren't even touched: a block sized for every tape only costs
+    // memory for the ones in use.
+    struct Free
+    {
+        void operator()(char* cells) const { free(cells); };
+    };
+    using Cells = std::unique_ptr<char[], Free>;
+    static Cells zeroed(size_t bytes);
+
+    size_t width;
+    Cells block;
+    size_t capacity;
+    size_t used;
+
+    // Whatever didn't fit in the block since the last reset.
+    std::vector<Cells> overflow;
+    size_t overflowed;
+
+    // Released cells, already zeroed, most recent last.
+    std::vector<std::pair<char*, size_t>> released;
+public:
+    TapeArena(): width(1), capacity(0), used(0), overflowed(0) {};
+    TapeArena(const TapeArena&) = delete;
+    TapeArena& operator=(const TapeArena&) = delete;
+
+    size_t cellSize() const { return width; };
+    void setCellSize(size_t bytes);
+    void reserve(size_t cells);
+    char* allocate(size_t cells);
+    char* acquire(size_t& cells);
+    void release(char* cells, size_t size);
+    void reset();
+};
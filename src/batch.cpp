@@ -0,0 +1,140 @@
+#include "batch.hpp"
+#include "cache.hpp"
+#include "mapped_file.hpp"
+#include "vm.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+#include <thread>
+
+// Scripts are dealt round robin in order of size, so every queue starts
+// with a share of the long ones.
+BatchRunner::BatchRunner(const std::vector<std::string>& paths, const BatchOptions& options, size_t threads)
+    : options(options)
+{
+    std::vector<std::pair<uintmax_t, size_t>> bySize;
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        std::error_code error;
+        auto size = std::filesystem::file_size(paths[i], error);
+        bySize.push_back({ error ? 0 : size, i });
+        results.push_back({ paths[i], "", "", 0 });
+    }
+    std::stable_sort(bySize.begin(), bySize.end(), [](auto& a, auto& b) { return a.first > b.first; });
+
+    threads = std::max<size_t>(1, std::min(threads, paths.size()));
+    for (size_t i = 0; i < threads; i++)
+    {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i < bySize.size(); i++)
+    {
+        queues[i % threads]->jobs.push_back(bySize[i].second);
+    }
+}
+
+// Takes from the front of this thread's own queue, otherwise from the back
+// of someone else's. No new work ever arrives, so once every queue is
+// empty the thread is done.
+bool BatchRunner::next(size_t self, size_t& job)
+{
+    {
+        auto& own = *queues[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.jobs.empty())
+        {
+            job = own.jobs.front();
+            own.jobs.pop_front();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+        auto& victim = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.back();
+            victim.jobs.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void BatchRunner::work(size_t self)
+{
+    size_t job;
+    while (next(self, job))
+    {
+        runScript(results[job]);
+    }
+}
+
+// Same steps and exit codes as running the script on its own, with the
+// streams redirected into the result.
+void BatchRunner::runScript(BatchResult& result) const
+{
+    std::ostringstream output;
+    std::ostringstream errors;
+
+    MappedFile file;
+    if (!file.open(result.path))
+    {
+        result.errors = "Failed to open " + result.path + "\n";
+        result.status = 74;
+        return;
+    }
+
+    auto instructions = Instructions();
+    auto vm = VM(instructions);
+    vm.setJit(options.jit);
+    vm.setTapeLimit(options.tapeLimit);
+    vm.setCellBits(options.cellBits);
+    vm.setUnchecked(options.unchecked);
+    vm.setFuel(options.fuel);
+    vm.setTimeLimit(options.timeLimit);
+    vm.setOutput(output);
+    vm.setErrors(errors);
+    vm.setInput(nullptr);
+
+    auto source = file.view();
+    auto cache = BytecodeCache(result.path, source, options.cellBits);
+    if (options.useCache && cache.load(instructions))
+    {
+        result.status = 0;
+    }
+    else if (vm.compile(source))
+    {
+        if (options.useCache) cache.save(instructions);
+        result.status = 0;
+    }
+    else
+    {
+        result.status = 65;
+    }
+
+    if (result.status == 0)
+    {
+        result.status = vm.run() == InterpretResult::OK ? 0 : 70;
+    }
+
+    result.output = output.str();
+    result.errors = errors.str();
+}
+
+const std::vector<BatchResult>& BatchRunner::run()
+{
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+        threads.emplace_back(&BatchRunner::work, this, i);
+    }
+    if (!queues.empty()) work(0);
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    return results;
+}
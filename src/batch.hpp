@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct BatchOptions
+{
+    bool jit;
+    bool useCache;
+    size_t tapeLimit;
+    int cellBits;
+    bool unchecked;
+    uint64_t fuel;
+    std::chrono::milliseconds timeLimit;
+};
+
+// What one script printed, and the exit code it would have had on its own.
+struct BatchResult
+{
+    std::string path;
+    std::string output;
+    std::string errors;
+    int status;
+};
+
+// Compiles and runs many scripts side by side, each with its own
+// Instructions and VM, output captured in memory and no input. Every
+// thread works through its own queue of scripts, biggest first, and steals
+// from the back of the others' once it runs dry, so a few long scripts
+// don't leave the other cores idle.
+class BatchRunner
+{
+private:
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+    };
+
+    BatchOptions options;
+    std::vector<BatchResult> results;
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    bool next(size_t self, size_t& job);
+    void work(size_t self);
+    void runScript(BatchResult& result) const;
+public:
+    BatchRunner(const std::vector<std::string>& paths, const BatchOptions& options, size_t threads);
+    const std::vector<BatchResult>& run();
+};
@@ -0,0 +1,115 @@
+#include "cache.hpp"
+#include "mapped_file.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+static const char MAGIC[4] = { 'Q', 'C', 'C', '\0' };
+static const size_t HEADER_SIZE = 16;
+
+// FNV-1a taken a word at a time, which is plenty to notice that a source
+// has been edited and keeps hashing a large file from costing more than
+// reading it.
+static uint64_t hashSource(std::string_view source)
+{
+    uint64_t hash = 14695981039346656037ull;
+    size_t i = 0;
+    for (; i + 8 <= source.size(); i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, source.data() + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    for (; i < source.size(); i++)
+    {
+        hash = (hash ^ static_cast<unsigned char>(source[i])) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Cache files go next to the source (prog.qc -> prog.qcc) unless
+// QUICKCHAT_CACHE_DIR names a directory to collect them in.
+static std::string cachePath(const std::string& sourcePath, uint64_t hash)
+{
+    auto dir = getenv("QUICKCHAT_CACHE_DIR");
+    if (dir != nullptr && *dir != '\0')
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.qcc", static_cast<unsigned long long>(hash));
+        return std::string(dir) + "/" + name;
+    }
+
+    auto dot = sourcePath.rfind('.');
+    auto slash = sourcePath.find_last_of("/\\");
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+    {
+        return sourcePath.substr(0, dot) + ".qcc";
+    }
+    return sourcePath + ".qcc";
+}
+
+// Code compiled for one cell width is wrong for the others, so the width
+// goes into the hash as one more step.
+BytecodeCache::BytecodeCache(const std::string& sourcePath, std::string_view source, int cellBits)
+    : hash((hashSource(source) ^ static_cast<uint64_t>(cellBits)) * 1099511628211ull)
+{
+    path = cachePath(sourcePath, hash);
+}
+
+static bool readHeader(const uint8_t* data, size_t size, uint64_t hash)
+{
+    if (size < HEADER_SIZE || memcmp(data, MAGIC, sizeof(MAGIC)) != 0) return false;
+
+    uint32_t version = 0;
+    uint64_t stored = 0;
+    for (int i = 0; i < 4; i++) version |= static_cast<uint32_t>(data[4 + i]) << (8 * i);
+    for (int i = 0; i < 8; i++) stored |= static_cast<uint64_t>(data[8 + i]) << (8 * i);
+
+    return version == BYTECODE_VERSION && stored == hash;
+}
+
+bool BytecodeCache::load(Instructions& instructions) const
+{
+    MappedFile file;
+    if (!file.open(path)) return false;
+
+    auto contents = file.view();
+    auto data = reinterpret_cast<const uint8_t*>(contents.data());
+    return readHeader(data, contents.size(), hash)
+        && instructions.deserialize(data + HEADER_SIZE, contents.size() - HEADER_SIZE);
+}
+
+// Written to a temporary name and renamed into place, so a run that
+// starts while another is saving never sees half a file. Failing to save
+// (a read-only directory, say) is not an error, the program just gets
+// compiled again next time.
+void BytecodeCache::save(const Instructions& instructions) const
+{
+    std::string contents(MAGIC, sizeof(MAGIC));
+    for (int i = 0; i < 4; i++) contents.push_back(static_cast<char>((BYTECODE_VERSION >> (8 * i)) & 0xFF));
+    for (int i = 0; i < 8; i++) contents.push_back(static_cast<char>((hash >> (8 * i)) & 0xFF));
+    instructions.serialize(contents);
+
+    // Scripts run side by side (--batch) may save the same file at once,
+    // so each thread writes its own temporary.
+    auto temporary = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return;
+        file.write(contents.data(), contents.size());
+        if (!file)
+        {
+            file.close();
+            remove(temporary.c_str());
+            return;
+        }
+    }
+
+    if (rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        remove(temporary.c_str());
+    }
+}
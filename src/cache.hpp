@@ -0,0 +1,22 @@
+#pragma once
+
+#include "instruction.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// A compiled program saved on disk so later runs of an unchanged source can
+// skip the parser and optimizer. The file is keyed on a hash of the source
+// and cell width, and the bytecode version; any mismatch just means
+// compiling again.
+class BytecodeCache
+{
+private:
+    std::string path;
+    uint64_t hash;
+public:
+    BytecodeCache(const std::string& sourcePath, std::string_view source, int cellBits);
+
+    bool load(Instructions& instructions) const;
+    void save(const Instructions& instructions) const;
+};
@@ -0,0 +1,206 @@
+#include "chunked_parser.hpp"
+#include <algorithm>
+#include <thread>
+
+// Cuts the source into 'count' pieces of about the same size, each ending
+// just after a '\n' (or at the end of the source).
+void ChunkedParser::split(size_t count)
+{
+    size_t begin = 0;
+    for (size_t i = 1; i <= count && begin < source.size(); i++)
+    {
+        auto end = i == count ? source.size() : std::max(begin + 1, source.size() * i / count);
+        while (end < source.size() && source[end - 1] != '\n') end++;
+
+        chunks.push_back({ source.substr(begin, end - begin), {}, true });
+        begin = end;
+    }
+}
+
+// The instruction a plain (non-loop) command compiles to.
+static OpCode commandOpCode(TokenType type)
+{
+    switch (type)
+    {
+        case TokenType::I_GOT_IT: return OpCode::INCPTR;
+        case TokenType::DEFENDING: return OpCode::DECPTR;
+        case TokenType::NICE_SHOT: return OpCode::INCATPTR;
+        case TokenType::NO_PROBLEM: return OpCode::DECATPTR;
+        case TokenType::CALCULATED: return OpCode::OUTPUT;
+        case TokenType::GREAT_PASS: return OpCode::COPY_FROM;
+        default: return OpCode::INPUT;
+    }
+}
+
+static bool isCommand(TokenType type)
+{
+    switch (type)
+    {
+        case TokenType::I_GOT_IT:
+        case TokenType::DEFENDING:
+        case TokenType::NICE_SHOT:
+        case TokenType::NO_PROBLEM:
+        case TokenType::CALCULATED:
+        case TokenType::GREAT_PASS:
+        case TokenType::INCOMING:
+        case TokenType::TAKE_THE_SHOT:
+        case TokenType::WHAT_A_SAVE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Runs on a worker. Lines don't depend on each other until names are
+// resolved, so the only state is the lexer over this chunk.
+void ChunkedParser::classify(Chunk& chunk)
+{
+    auto lexer = Lexer(chunk.source);
+    chunk.lines.reserve(chunk.source.size() / 12);
+
+    while (true)
+    {
+        auto name = lexer.scanToken();
+        if (name.type == TokenType::_EOF) return;
+        if (name.type != TokenType::IDENTIFIER) break;
+
+        auto line = ChunkLine();
+        line.name = name.text;
+        line.caps = std::none_of(name.text.begin(), name.text.end(), [](char c) { return c >= 'a' && c <= 'z'; });
+
+        auto separator = lexer.scanToken();
+        if (separator.type == TokenType::COLON)
+        {
+            if (lexer.scanToken().type != TokenType::SINGLE_SPACE) break;
+            line.command = lexer.scanToken().type;
+            line.roster = false;
+            if (!isCommand(line.command)) break;
+        }
+        else if (separator.type == TokenType::SINGLE_SPACE)
+        {
+            line.command = lexer.scanToken().type;
+            line.roster = true;
+            if (line.command != TokenType::JOINED && line.command != TokenType::LEFT) break;
+        }
+        else
+        {
+            break;
+        }
+
+        auto end = lexer.scanToken().type;
+        if (end != TokenType::NEW_LINE && end != TokenType::_EOF) break;
+        line.newline = end == TokenType::NEW_LINE;
+        chunk.lines.push_back(line);
+        if (!line.newline) return;
+    }
+
+    chunk.regular = false;
+}
+
+struct OpenLoop
+{
+    int tape;
+    int start;
+};
+
+// Replays what Parser::line() does for each line, byte for byte and line
+// for line: BEGIN and plain commands carry the line they are on, END the
+// line after its 'What a save!' (the newline token Parser has just
+// consumed), unless that was the last line of the source.
+bool ChunkedParser::emit()
+{
+    std::vector<OpenLoop> loops;
+
+    int line = 0;
+    for (auto& chunk : chunks)
+    {
+        for (auto& entry : chunk.lines)
+        {
+            line++;
+
+            if (entry.roster)
+            {
+                auto symbol = instructions.findName(entry.name);
+
+                if (symbol == nullptr)
+                {
+                    if (entry.command != TokenType::JOINED || instructions.tapeCount() == MAX_TAPES) return false;
+                    instructions.defineName(entry.name, line);
+                }
+                else
+                {
+                    // Only ever joining after leaving, or leaving after
+                    // joining.
+                    if (symbol->left != (entry.command == TokenType::JOINED)) return false;
+                    symbol->left = !symbol->left;
+                    toggled.push_back(symbol->slot);
+                    instructions.write(symbol->left ? OpCode::DELETE_NAME : OpCode::DEFINE_NAME, symbol->slot, line);
+                }
+                continue;
+            }
+
+            auto symbol = instructions.findName(entry.name);
+            if (!entry.caps || symbol == nullptr || symbol->left) return false;
+            auto tape = symbol->slot;
+
+            switch (entry.command)
+            {
+                case TokenType::TAKE_THE_SHOT:
+                    loops.push_back({ tape, instructions.beginLoop(tape, line) });
+                    break;
+                case TokenType::WHAT_A_SAVE:
+                    if (loops.empty() || loops.back().tape != tape) return false;
+                    instructions.endLoop(loops.back().start, entry.newline ? line + 1 : line);
+                    loops.pop_back();
+                    break;
+                default:
+                    instructions.write(commandOpCode(entry.command), tape, line);
+                    break;
+            }
+        }
+    }
+
+    return loops.empty();
+}
+
+bool ChunkedParser::compile()
+{
+    if (source.size() < CHUNKED_PARSE_MIN) return false;
+
+    // One chunk per core. Even on one core this beats Parser on sources
+    // this large, so it still gets used there.
+    auto threads = std::max(1u, std::thread::hardware_concurrency());
+    split(std::min<size_t>(threads, source.size() / CHUNK_MIN));
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < chunks.size(); i++)
+    {
+        workers.emplace_back(&ChunkedParser::classify, std::ref(chunks[i]));
+    }
+    classify(chunks[0]);
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    // Any line Parser might treat differently sends the whole source back
+    // to it.
+    for (auto& chunk : chunks)
+    {
+        if (!chunk.regular) return false;
+    }
+
+    auto codeStart = instructions.codeCount();
+    auto tapeStart = instructions.tapeCount();
+    if (emit()) return true;
+
+    instructions.truncate(codeStart);
+    instructions.truncateNames(tapeStart);
+    for (auto slot : toggled)
+    {
+        if (slot >= tapeStart) continue;
+        auto symbol = instructions.findName(instructions.getNameAt(slot));
+        symbol->left = !symbol->left;
+    }
+    return false;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "instruction.hpp"
+#include "lexer.hpp"
+#include <string_view>
+#include <vector>
+
+// Smaller sources go straight to Parser, and no chunk is made smaller
+// than CHUNK_MIN just to keep another core busy.
+const size_t CHUNKED_PARSE_MIN = 1 << 20;
+const size_t CHUNK_MIN = 1 << 18;
+
+// One well-formed line, as classified by a worker. Its line number is its
+// position in the source, since every such line ends in exactly one
+// newline.
+struct ChunkLine
+{
+    std::string_view name;
+    TokenType command;
+    bool roster;        // "<Name> joined/left the match" rather than "<NAME>: <COMMAND>".
+    bool caps;          // The name is already in ALL CAPS.
+    bool newline;       // Ends in a newline rather than the end of the source.
+};
+
+struct Chunk
+{
+    std::string_view source;
+    std::vector<ChunkLine> lines;
+    bool regular;
+};
+
+// Front end for large, machine-generated programs. Workers lex and
+// classify newline-aligned chunks of the source in parallel, then one
+// sequential pass resolves names, matches loops and emits exactly the
+// bytecode Parser would. Anything out of the ordinary (an error or a
+// blank line) makes it give up without touching the instructions, and
+// Parser handles the source instead, diagnostics and all.
+class ChunkedParser
+{
+private:
+    std::string_view source;
+    Instructions& instructions;
+    std::vector<Chunk> chunks;
+    std::vector<int> toggled;   // Players emit() saw join again or leave, to take back if it gives up.
+
+    void split(size_t count);
+    static void classify(Chunk& chunk);
+    bool emit();
+public:
+    ChunkedParser(std::string_view source, Instructions& instructions)
+        : source(source), instructions(instructions) {};
+    bool compile();
+};
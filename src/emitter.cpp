@@ -0,0 +1,237 @@
+#include "emitter.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+static const char* prelude = R"(#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CELL(t) tapes[t][ptrs[t]]
+
+static void fail(const char* message, int line)
+{
+    fflush(stdout);
+    fprintf(stderr, "%s\n[line %d] in script\n", message, line);
+    exit(70);
+}
+)";
+
+// A program can have thousands of tapes, far too many to give each its
+// full size up front, so a tape gets its cells when its player first
+// joins, the way the interpreter's arena hands them out. Until then it
+// is parked on the one zero cell every tape starts on.
+static const char* tapes = R"(static unsigned char parked[1];
+static unsigned char* tapes[TAPE_COUNT];
+static size_t ptrs[TAPE_COUNT];
+
+static void join(int t)
+{
+    if (tapes[t] == parked)
+    {
+        tapes[t] = calloc(TAPE_SIZE, 1);
+        if (tapes[t] == NULL)
+        {
+            fputs("Out of memory.\n", stderr);
+            exit(70);
+        }
+    }
+    else
+    {
+        memset(tapes[t], 0, TAPE_SIZE);
+    }
+    ptrs[t] = 0;
+}
+
+static void leave(int t)
+{
+    if (tapes[t] != parked) memset(tapes[t], 0, TAPE_SIZE);
+    ptrs[t] = 0;
+}
+)";
+
+void CEmitter::emit(const std::string& name)
+{
+    auto program = std::vector<DecodedInstruction>();
+    instructions.decode(0, program);
+    auto tapeCount = std::max(instructions.tapeCount(), 1);
+
+    out << "/* Generated by quickchat from " << name << " */" << std::endl;
+    out << prelude << std::endl;
+    out << "#define TAPE_SIZE " << tapeLimit << std::endl;
+    out << "#define TAPE_COUNT " << tapeCount << std::endl;
+    out << tapes << std::endl;
+    out << "int main(void)" << std::endl;
+    out << "{" << std::endl;
+    line("for (int t = 0; t < TAPE_COUNT; t++) tapes[t] = parked;");
+    for (const auto& instruction : program)
+    {
+        emitInstruction(instruction);
+    }
+    line("return 0;");
+    out << "}" << std::endl;
+}
+
+void CEmitter::line(const std::string& text)
+{
+    out << std::string(depth * 4, ' ') << text << std::endl;
+}
+
+void CEmitter::fail(const std::string& message, const std::string& line)
+{
+    this->line("    fail(\"" + message + "\", " + line + ");");
+}
+
+// Same line the VM reports for an instruction: that of its last byte.
+int CEmitter::lineOf(const DecodedInstruction& instruction) const
+{
+    return instructions.getLineAt(instruction.source + instructions.getSizeAt(instruction.source) - 1);
+}
+
+// C expression for the line of the move that fails in a folded run, given
+// how many of its moves succeed first (see VM::moveError). A MUL_ADD
+// stands for the moves out to its offset.
+std::string CEmitter::foldedLine(const DecodedInstruction& instruction, const std::string& moves) const
+{
+    auto count = instruction.opcode == OpCode::MUL_ADD ? instruction.offset : std::abs(instruction.operand);
+    auto first = instructions.getLineAt(instruction.source);
+    auto last = lineOf(instruction);
+    auto step = count == 1 ? 0 : (last - first) / (count - 1);
+    return std::to_string(first) + " + (int)(" + moves + ") * " + std::to_string(step);
+}
+
+void CEmitter::emitInstruction(const DecodedInstruction& instruction)
+{
+    auto t = std::to_string(instruction.tape);
+    auto cell = "CELL(" + t + ")";
+    auto ptr = "ptrs[" + t + "]";
+    auto name = instructions.getNameAt(instruction.tape);
+    auto underflow = "Attempting to decrement the pointer below 0 on " + name + ".";
+    auto pastEnd = "Attempting to increment the pointer past the end of " + name + ".";
+
+    switch (instruction.opcode)
+    {
+        case OpCode::INCPTR:
+            line("if (" + ptr + " + 1 >= TAPE_SIZE)");
+            fail(pastEnd, std::to_string(lineOf(instruction)));
+            line(ptr + "++;");
+            break;
+        case OpCode::DECPTR:
+            line("if (" + ptr + " == 0)");
+            fail(underflow, std::to_string(lineOf(instruction)));
+            line(ptr + "--;");
+            break;
+        case OpCode::INCATPTR:
+            line(cell + "++;");
+            break;
+        case OpCode::DECATPTR:
+            line(cell + "--;");
+            break;
+        case OpCode::OUTPUT:
+            line("putchar(" + cell + ");");
+            break;
+        case OpCode::INPUT:
+            line(cell + " = (unsigned char)getchar();");
+            break;
+        case OpCode::BEGIN:
+            line("while (" + cell + ")");
+            line("{");
+            depth++;
+            break;
+        case OpCode::END:
+            depth--;
+            line("}");
+            break;
+        case OpCode::DEFINE_NAME:
+            line("join(" + t + ");");
+            break;
+        case OpCode::DELETE_NAME:
+            line("leave(" + t + ");");
+            break;
+        case OpCode::COPY_FROM:
+            line("if (" + cell + " >= TAPE_COUNT)");
+            fail("Attempting to copy a value from a tape that does not exist.", std::to_string(lineOf(instruction)));
+            line(cell + " = CELL(" + cell + ");");
+            break;
+        case OpCode::ADD:
+            line(cell + " += " + std::to_string(instruction.operand) + ";");
+            break;
+        case OpCode::MOVE:
+        {
+            auto count = std::to_string(std::abs(instruction.operand));
+            if (instruction.operand > 0)
+            {
+                line("if (" + ptr + " + " + count + " >= TAPE_SIZE)");
+                fail(pastEnd, foldedLine(instruction, "TAPE_SIZE - 1 - " + ptr));
+                line(ptr + " += " + count + ";");
+            }
+            else
+            {
+                line("if (" + ptr + " < " + count + ")");
+                fail(underflow, foldedLine(instruction, ptr));
+                line(ptr + " -= " + count + ";");
+            }
+            break;
+        }
+        case OpCode::SET_ZERO:
+            line(cell + " = 0;");
+            break;
+        case OpCode::MUL_ADD:
+        {
+            auto to = std::to_string(instruction.other);
+            auto offset = std::to_string(instruction.offset);
+            auto target = "ptrs[" + to + "] + " + offset;
+            line("if (" + cell + ")");
+            line("{");
+            depth++;
+            line("if (" + target + " >= TAPE_SIZE)");
+            fail("Attempting to increment the pointer past the end of " + instructions.getNameAt(instruction.other) + ".",
+                foldedLine(instruction, "TAPE_SIZE - 1 - ptrs[" + to + "]"));
+            line("tapes[" + to + "][" + target + "] += " + cell + " * " + std::to_string(instruction.operand) + ";");
+            depth--;
+            line("}");
+            break;
+        }
+        case OpCode::SCAN:
+        {
+            auto stride = instruction.operand;
+            if (stride == 1)
+            {
+                line("{");
+                depth++;
+                line("unsigned char* found = memchr(&" + cell + ", 0, TAPE_SIZE - " + ptr + ");");
+                line("if (found == NULL)");
+                fail(pastEnd, std::to_string(lineOf(instruction)));
+                line(ptr + " = found - tapes[" + t + "];");
+                depth--;
+                line("}");
+                break;
+            }
+            auto count = std::to_string(std::abs(stride));
+            line("while (" + cell + ")");
+            line("{");
+            depth++;
+            if (stride < 0)
+            {
+                line("if (" + ptr + " < " + count + ")");
+                fail(underflow, foldedLine(instruction, ptr));
+                line(ptr + " -= " + count + ";");
+            }
+            else
+            {
+                line("if (" + ptr + " + " + count + " >= TAPE_SIZE)");
+                fail(pastEnd, foldedLine(instruction, "TAPE_SIZE - 1 - " + ptr));
+                line(ptr + " += " + count + ";");
+            }
+            depth--;
+            line("}");
+            break;
+        }
+        default:
+            // decode() hands out nothing else. Anything new needs a case
+            // here rather than quietly dropping out of the C.
+            std::cerr << "Can't emit C for " << opCodeName(instruction.opcode) << "." << std::endl;
+            abort();
+    }
+}
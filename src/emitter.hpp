@@ -0,0 +1,27 @@
+#pragma once
+
+#include "instruction.hpp"
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+// Writes a compiled program out as a standalone C translation unit that
+// behaves like running it in the VM, runtime errors included.
+class CEmitter
+{
+private:
+    const Instructions& instructions;
+    std::ostream& out;
+    size_t tapeLimit;
+    int depth;
+
+    void line(const std::string& text);
+    void fail(const std::string& message, const std::string& line);
+    int lineOf(const DecodedInstruction& instruction) const;
+    std::string foldedLine(const DecodedInstruction& instruction, const std::string& moves) const;
+    void emitInstruction(const DecodedInstruction& instruction);
+public:
+    CEmitter(const Instructions& instructions, std::ostream& out, size_t tapeLimit)
+        : instructions(instructions), out(out), tapeLimit(tapeLimit), depth(1) {};
+    void emit(const std::string& name);
+};
@@ -2,6 +2,92 @@
 #include <iostream>
 #include <algorithm>
 
+int opCodeSize(OpCode opcode)
+{
+    switch (opcode)
+    {
+        case OpCode::BEGIN:
+        case OpCode::END:
+            return 4;
+        case OpCode::ADD:
+        case OpCode::MOVE:
+        case OpCode::SCAN:
+            return 3;
+        case OpCode::MUL_ADD:
+            return 5;
+        default:
+            return 2;
+    }
+}
+
+const char* opCodeName(OpCode opcode)
+{
+    switch (opcode)
+    {
+        case OpCode::INCPTR: return "INCPTR";
+        case OpCode::DECPTR: return "DECPTR";
+        case OpCode::INCATPTR: return "INCATPTR";
+        case OpCode::DECATPTR: return "DECATPTR";
+        case OpCode::OUTPUT: return "OUTPUT";
+        case OpCode::INPUT: return "INPUT";
+        case OpCode::BEGIN: return "BEGIN";
+        case OpCode::END: return "END";
+        case OpCode::DEFINE_NAME: return "DEFINE_NAME";
+        case OpCode::DELETE_NAME: return "DELETE_NAME";
+        case OpCode::COPY_FROM: return "COPY_FROM";
+        case OpCode::ADD: return "ADD";
+        case OpCode::MOVE: return "MOVE";
+        case OpCode::SET_ZERO: return "SET_ZERO";
+        case OpCode::MUL_ADD: return "MUL_ADD";
+        case OpCode::SCAN: return "SCAN";
+        case OpCode::HALT: return "HALT";
+        case OpCode::INCPTR_UNCHECKED: return "INCPTR_UNCHECKED";
+        case OpCode::DECPTR_UNCHECKED: return "DECPTR_UNCHECKED";
+        case OpCode::MOVE_UNCHECKED: return "MOVE_UNCHECKED";
+        case OpCode::COPY_FROM_UNCHECKED: return "COPY_FROM_UNCHECKED";
+        case OpCode::MUL_ADD_UNCHECKED: return "MUL_ADD_UNCHECKED";
+    }
+    return "UNKNOWN";
+}
+
+// A wide instruction has a second byte for each tape operand and two more
+// for its jump.
+int instructionSize(uint8_t byte)
+{
+    auto opcode = opCodeOf(byte);
+    auto size = opCodeSize(opcode);
+    if ((byte & WIDE) == 0) return size;
+
+    switch (opcode)
+    {
+        case OpCode::BEGIN:
+        case OpCode::END:
+            return size + 3;
+        case OpCode::MUL_ADD:
+            return size + 2;
+        default:
+            return size + 1;
+    }
+}
+
+int tapeOf(const uint8_t* at)
+{
+    return at[0] & WIDE ? (at[1] << 8) | at[2] : at[1];
+}
+
+int otherTapeOf(const uint8_t* at)
+{
+    return at[0] & WIDE ? (at[3] << 8) | at[4] : at[2];
+}
+
+// Jumps are big endian and fill the end of the instruction.
+uint32_t jumpOf(const uint8_t* at)
+{
+    auto size = instructionSize(at[0]);
+    if ((at[0] & WIDE) == 0) return (at[size - 2] << 8) | at[size - 1];
+    return (static_cast<uint32_t>(at[size - 4]) << 24) | (at[size - 3] << 16) | (at[size - 2] << 8) | at[size - 1];
+}
+
 void Instructions::write(uint8_t byte, int line)
 {
     code.push_back(byte);
@@ -13,78 +99,340 @@ void Instructions::write(OpCode opcode, int line)
     write(static_cast<uint8_t>(opcode), line);
 }
 
-void Instructions::patchJump(int tape, int offset)
+void Instructions::writeTape(int tape, bool wide, int line)
+{
+    if (wide) write(static_cast<uint8_t>(tape >> 8), line);
+    write(static_cast<uint8_t>(tape), line);
+}
+
+// Writes 'opcode' and its tape operand, wide only if the tape needs it.
+void Instructions::write(OpCode opcode, int tape, int line)
 {
-    int jump = codeCount() - offset - 3;
+    auto wide = tape > UINT8_MAX;
+    write(static_cast<uint8_t>(static_cast<uint8_t>(opcode) | (wide ? WIDE : 0)), line);
+    writeTape(tape, wide, line);
+}
 
-    code[static_cast<int>(offset + 1)] = (jump >> 8) & 0xFF;
-    code[static_cast<int>(offset + 2)] = jump & 0xFF;
+void Instructions::write(OpCode opcode, int tape, int other, int line)
+{
+    auto wide = tape > UINT8_MAX || other > UINT8_MAX;
+    write(static_cast<uint8_t>(static_cast<uint8_t>(opcode) | (wide ? WIDE : 0)), line);
+    writeTape(tape, wide, line);
+    writeTape(other, wide, line);
 }
 
-std::optional<int> Instructions::defineName(const std::string& name, int line)
+// Stores 'jump' in the jump field of the BEGIN or END at 'offset'.
+void Instructions::writeJump(int offset, uint32_t jump)
 {
-    if (findName(name).has_value())
+    auto size = instructionSize(code[offset]);
+    auto bytes = code[offset] & WIDE ? 4 : 2;
+    for (int i = 0; i < bytes; i++)
+    {
+        code[offset + size - 1 - i] = (jump >> (8 * i)) & 0xFF;
+    }
+}
+
+// Points the BEGIN at 'offset' just past the END that was written last.
+void Instructions::patchJump(int offset)
+{
+    writeJump(offset, codeCount() - offset - instructionSize(code[offset]));
+}
+
+// Rewrites the narrow BEGIN at 'offset' as a wide one. Only the loop's own
+// body moves, and every jump in there is relative.
+void Instructions::widen(int offset)
+{
+    auto tape = code[offset + 1];
+    auto line = lines[offset];
+    uint8_t wide[] = { static_cast<uint8_t>(static_cast<uint8_t>(OpCode::BEGIN) | WIDE), 0, tape, 0xFF, 0xFF, 0xFF, 0xFF };
+
+    code.erase(code.begin() + offset, code.begin() + offset + opCodeSize(OpCode::BEGIN));
+    code.insert(code.begin() + offset, std::begin(wide), std::end(wide));
+    lines.erase(lines.begin() + offset, lines.begin() + offset + opCodeSize(OpCode::BEGIN));
+    lines.insert(lines.begin() + offset, sizeof(wide), line);
+}
+
+// Opens a loop on 'tape' and returns where it starts, for endLoop.
+int Instructions::beginLoop(int tape, int line)
+{
+    auto loopStart = codeCount();
+    write(OpCode::BEGIN, tape, line);
+    auto jumpBytes = instructionSize(code[loopStart]) - (codeCount() - loopStart);
+    for (int i = 0; i < jumpBytes; i++)
+    {
+        write(0xFF, line);
+    }
+    return loopStart;
+}
+
+// Closes the loop opened at 'loopStart' and patches its BEGIN. A BEGIN too
+// far back for a 16-bit jump is widened first; the END matches its width.
+void Instructions::endLoop(int loopStart, int line)
+{
+    auto tape = tapeOf(&code[loopStart]);
+    bool wide = code[loopStart] & WIDE;
+    if (!wide && codeCount() + opCodeSize(OpCode::END) - loopStart > UINT16_MAX)
+    {
+        widen(loopStart);
+        wide = true;
+    }
+
+    auto end = codeCount();
+    write(static_cast<uint8_t>(static_cast<uint8_t>(OpCode::END) | (wide ? WIDE : 0)), line);
+    writeTape(tape, wide, line);
+    while (codeCount() < end + instructionSize(code[end]))
+    {
+        write(0xFF, line);
+    }
+
+    writeJump(end, codeCount() - loopStart);
+    patchJump(loopStart);
+}
+
+std::optional<int> Instructions::defineName(std::string_view name, int line)
+{
+    if (names.find(name) != nullptr)
     {
         return {};
     }
     else
     {
-        names.push_back(name);
-        auto result = names.size() - 1;
-        write(OpCode::DEFINE_NAME, line);
-        write(result, line);
+        auto result = names.define(name);
+        write(OpCode::DEFINE_NAME, result, line);
         return result;
     }
 }
 
-std::optional<int> Instructions::findName(const std::string& name) const
+void Instructions::decode(int from, std::vector<DecodedInstruction>& out) const
 {
-    auto result = std::find(names.begin(), names.end(), name);
-    if (result != std::end(names))
+    // Byte offset (relative to 'from') -> index in 'out', so jumps can be
+    // resolved once here. The extra slot is the end of the code.
+    auto size = static_cast<int>(code.size());
+    std::vector<uint32_t> indexAt(size - from + 1, 0);
+    auto index = static_cast<uint32_t>(out.size());
+    for (int offset = from; offset < size; offset += instructionSize(code[offset]))
     {
-        return result - names.begin();
+        indexAt[offset - from] = index++;
     }
-    else
+    indexAt[size - from] = index;
+
+    auto jumpTo = [&](int target) -> uint32_t
     {
-        return {};
+        // Only code left behind by a failed compile can jump outside the
+        // fragment; send it to the end, where the old offsets would have.
+        if (target < from || target > size) return indexAt[size - from];
+        return indexAt[target - from];
+    };
+
+    for (int offset = from; offset < size; offset += instructionSize(code[offset]))
+    {
+        auto at = &code[offset];
+        auto last = instructionSize(*at) - 1;
+        auto decoded = DecodedInstruction();
+        decoded.opcode = opCodeOf(*at);
+        decoded.tape = tapeOf(at);
+        decoded.source = offset;
+
+        switch (decoded.opcode)
+        {
+            case OpCode::BEGIN:
+                decoded.jump = jumpTo(offset + last + 1 + static_cast<int>(jumpOf(at)));
+                break;
+            case OpCode::END:
+            {
+                // Jumps straight into the body, END re-tests the loop cell.
+                auto begin = offset + last + 1 - static_cast<int>(jumpOf(at));
+                decoded.jump = begin < from || begin >= size ? jumpTo(size) : jumpTo(begin) + 1;
+                break;
+            }
+            // Counts and factors are signed, so they come out the same
+            // whatever the cell width they wrap at.
+            case OpCode::ADD:
+            case OpCode::MOVE:
+            case OpCode::SCAN:
+                decoded.operand = static_cast<int8_t>(at[last]);
+                break;
+            case OpCode::MUL_ADD:
+                decoded.other = otherTapeOf(at);
+                decoded.offset = at[last - 1];
+                decoded.operand = static_cast<int8_t>(at[last]);
+                break;
+            default:
+                break;
+        }
+        out.push_back(decoded);
+    }
+}
+
+static void putWord(std::string& out, uint32_t value)
+{
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        out.push_back(static_cast<char>((value >> shift) & 0xFF));
     }
 }
 
+static uint32_t getWord(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+// Layout: code count, name count, the code, one line per code byte, then
+// each name as its length followed by its characters. Words are little
+// endian whatever the host.
+void Instructions::serialize(std::string& out) const
+{
+    putWord(out, code.size());
+    putWord(out, names.size());
+    out.append(code.begin(), code.end());
+    for (auto line : lines)
+    {
+        putWord(out, line);
+    }
+    for (int i = 0; i < names.size(); i++)
+    {
+        putWord(out, names.nameAt(i).size());
+        out.append(names.nameAt(i));
+    }
+}
+
+// Replaces the program with one read back from 'data'. Anything that
+// would send the VM outside the code or the tapes is rejected, leaving
+// the program empty.
+bool Instructions::deserialize(const uint8_t* data, size_t size)
+{
+    clear();
+    names.clear();
+
+    auto end = data + size;
+    if (size < 8) return false;
+    size_t codeSize = getWord(data);
+    size_t nameCount = getWord(data + 4);
+    data += 8;
+
+    if (static_cast<size_t>(end - data) / 5 < codeSize) return false;
+    code.assign(data, data + codeSize);
+    data += codeSize;
+    lines.resize(codeSize);
+    for (auto& line : lines)
+    {
+        line = static_cast<int32_t>(getWord(data));
+        data += 4;
+    }
+
+    for (size_t i = 0; i < nameCount; i++)
+    {
+        if (end - data < 4) break;
+        size_t length = getWord(data);
+        data += 4;
+        if (static_cast<size_t>(end - data) < length) break;
+        names.define(std::string_view(reinterpret_cast<const char*>(data), length));
+        data += length;
+    }
+
+    auto valid = static_cast<size_t>(names.size()) == nameCount && data == end;
+
+    std::vector<bool> boundary(codeSize + 1, false);
+    int offset = 0;
+    while (valid && offset < static_cast<int>(codeSize))
+    {
+        auto at = &code[offset];
+        auto opcode = opCodeOf(*at);
+        boundary[offset] = true;
+        valid = opcode < OpCode::HALT
+            && offset + instructionSize(*at) <= static_cast<int>(codeSize)
+            && static_cast<size_t>(tapeOf(at)) < nameCount
+            && (opcode != OpCode::MUL_ADD || static_cast<size_t>(otherTapeOf(at)) < nameCount);
+        offset += instructionSize(*at);
+    }
+    boundary[codeSize] = true;
+
+    for (offset = 0; valid && offset < static_cast<int>(codeSize); offset += instructionSize(code[offset]))
+    {
+        auto at = &code[offset];
+        auto opcode = opCodeOf(*at);
+        if (opcode != OpCode::BEGIN && opcode != OpCode::END) continue;
+        int64_t end = offset + instructionSize(*at);
+        auto target = opcode == OpCode::BEGIN ? end + jumpOf(at) : end - jumpOf(at);
+        valid = target >= 0 && target <= static_cast<int64_t>(codeSize) && boundary[target];
+    }
+
+    if (!valid)
+    {
+        clear();
+        names.clear();
+    }
+    return valid;
+}
+
+void Instructions::truncate(int offset)
+{
+    code.resize(offset);
+    lines.resize(offset);
+}
+
+void Instructions::truncateNames(int count)
+{
+    names.truncate(count);
+}
+
 void Instructions::clear()
 {
     code.clear();
     lines.clear();
 }
 
-int Instructions::tapeInstruction(const std::string& name, int offset)
+// Wide instructions are listed with a 'W' after their name.
+int Instructions::tapeInstruction(const std::string& name, int offset) const
+{
+    auto at = &code[offset];
+    std::cout << name << (*at & WIDE ? "W " : " ");
+    std::cout << names.nameAt(tapeOf(at)) << std::endl;
+    return offset + instructionSize(*at);
+}
+
+int Instructions::jumpInstruction(const std::string& name, int sign, int offset) const
+{
+    auto at = &code[offset];
+    auto size = instructionSize(*at);
+    std::cout << name << (*at & WIDE ? "W " : " ");
+    std::cout << names.nameAt(tapeOf(at)) << " ";
+    int64_t jump = jumpOf(at);
+    std::cout << offset << " -> " << offset + size + sign * jump << std::endl;
+    return offset + size;
+}
+
+int Instructions::countInstruction(const std::string& name, int offset) const
 {
-    std::cout << name << " ";
-    auto tape = code[static_cast<int>(offset + 1)];
-    std::cout << names[tape] << std::endl;
-    return offset + 2;
+    auto at = &code[offset];
+    auto size = instructionSize(*at);
+    std::cout << name << (*at & WIDE ? "W " : " ");
+    std::cout << names.nameAt(tapeOf(at)) << " ";
+    std::cout << static_cast<int>(static_cast<int8_t>(at[size - 1])) << std::endl;
+    return offset + size;
 }
 
-int Instructions::jumpInstruction(const std::string& name, int sign, int offset)
+int Instructions::mulAddInstruction(const std::string& name, int offset) const
 {
-    std::cout << name << " ";
-    auto tape = code[static_cast<int>(offset + 1)];
-    std::cout << names[tape] << " ";
-    uint16_t jump = (uint16_t)(code[static_cast<int>(offset + 2)] << 8);
-    jump |= code[static_cast<int>(offset + 3)];
-    std::cout << offset << " -> " << offset + 4 + sign * jump << std::endl;
-    return offset + 4;
+    auto at = &code[offset];
+    auto size = instructionSize(*at);
+    std::cout << name << (*at & WIDE ? "W " : " ");
+    std::cout << names.nameAt(tapeOf(at)) << " -> " << names.nameAt(otherTapeOf(at));
+    std::cout << "+" << static_cast<int>(at[size - 2]) << " ";
+    std::cout << "* " << static_cast<int>(static_cast<int8_t>(at[size - 1])) << std::endl;
+    return offset + size;
 }
 
-void Instructions::disassemble(const std::string& name)
+void Instructions::disassemble(const std::string& name) const
 {
     std::cout << "== " << name << " ==" << std::endl;
-    for (int offset = 0; offset < code.size();)
+    for (int offset = 0; offset < codeCount();)
     {
         offset = disassembleInstructionAt(offset);
     }
 }
 
-int Instructions::disassembleInstructionAt(int offset)
+int Instructions::disassembleInstructionAt(int offset) const
 {
     std::cout << offset << " ";
     auto currentLine = getLineAt(offset);
@@ -97,7 +445,7 @@ int Instructions::disassembleInstructionAt(int offset)
         std::cout << currentLine << " ";
     }
 
-    auto instruction = OpCode(code[offset]);
+    auto instruction = opCodeOf(code[offset]);
     switch (instruction)
     {
         case OpCode::BEGIN:
@@ -122,6 +470,16 @@ int Instructions::disassembleInstructionAt(int offset)
             return tapeInstruction("DELETE_NAME", offset);
         case OpCode::COPY_FROM:
             return tapeInstruction("COPY_FROM", offset);
+        case OpCode::ADD:
+            return countInstruction("ADD", offset);
+        case OpCode::MOVE:
+            return countInstruction("MOVE", offset);
+        case OpCode::SET_ZERO:
+            return tapeInstruction("SET_ZERO", offset);
+        case OpCode::MUL_ADD:
+            return mulAddInstruction("MUL_ADD", offset);
+        case OpCode::SCAN:
+            return countInstruction("SCAN", offset);
 
         default:
             std::cout << "Unknown opcode: " << code[offset] << std::endl;
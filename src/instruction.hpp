@@ -1,8 +1,11 @@
 #pragma once
 
+#include "symbol_table.hpp"
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <optional>
 
 enum class OpCode: uint8_t 
@@ -19,34 +22,111 @@ enum class OpCode: uint8_t
     DEFINE_NAME,
     DELETE_NAME,
     COPY_FROM,
+
+    // Emitted by the Optimizer, never by the Parser.
+    ADD,
+    MOVE,
+    SET_ZERO,
+    MUL_ADD,
+    SCAN,
+
+    // Only ever appears at the end of a decoded stream.
+    HALT,
+
+    // Swapped in for the checked versions by the Analyzer, only ever in a
+    // decoded stream.
+    INCPTR_UNCHECKED,
+    DECPTR_UNCHECKED,
+    MOVE_UNCHECKED,
+    COPY_FROM_UNCHECKED,
+    MUL_ADD_UNCHECKED,
+};
+
+int opCodeSize(OpCode opcode);
+const char* opCodeName(OpCode opcode);
+
+// Set on the opcode byte of an instruction whose tape operands take two
+// bytes and whose jump takes four. Only programs with more than 256 tapes
+// or loops longer than 64 KB need it; everything else stays narrow.
+const uint8_t WIDE = 0x80;
+
+// Tape indices have to fit a wide operand.
+const int MAX_TAPES = UINT16_MAX + 1;
+
+inline OpCode opCodeOf(uint8_t byte) { return OpCode(byte & ~WIDE); }
+int instructionSize(uint8_t byte);
+
+// Operands of the instruction whose opcode byte 'at' points to, in either
+// width. Counts, offsets and factors are always single bytes at the end.
+int tapeOf(const uint8_t* at);
+int otherTapeOf(const uint8_t* at);
+uint32_t jumpOf(const uint8_t* at);
+
+// Bumped whenever the encoding of an instruction changes, so cache files
+// written by an older build are recompiled instead of misread.
+const uint32_t BYTECODE_VERSION = 2;
+
+// Fixed-width form of one instruction, with its jump already resolved to an
+// index in the decoded stream so the VM never has to rebuild offsets.
+struct DecodedInstruction
+{
+    OpCode opcode;
+    uint8_t offset;     // MUL_ADD: cell offset on that tape.
+    uint16_t tape;
+    uint16_t other;     // MUL_ADD: tape the product is added to.
+    int16_t operand;    // ADD/MOVE/SCAN count, MUL_ADD factor.
+    uint32_t jump;      // BEGIN/END: index of the instruction to go to.
+    uint32_t source;    // Offset of the instruction in the bytecode.
 };
 
+static_assert(sizeof(DecodedInstruction) == 16, "DecodedInstruction should stay 16 bytes");
+
 class Instructions
 {
 private:
     std::vector<uint8_t> code;
     std::vector<int> lines;
-    std::vector<std::string> names;
+    SymbolTable names;
+
+    int tapeInstruction(const std::string& name, int offset) const;
+    int jumpInstruction(const std::string& name, int sign, int offset) const;
+    int countInstruction(const std::string& name, int offset) const;
+    int mulAddInstruction(const std::string& name, int offset) const;
 
-    int tapeInstruction(const std::string& name, int offset);
-    int jumpInstruction(const std::string& name, int sign, int offset);
+    void writeTape(int tape, bool wide, int line);
+    void writeJump(int offset, uint32_t jump);
+    void patchJump(int offset);
+    void widen(int offset);
 public:
     int getLineAt(int instruction) const { return lines[instruction]; };
-    std::string getNameAt(int idx) const { return names[idx]; };
+    const std::string& getNameAt(int idx) const { return names.nameAt(idx); };
     uint8_t getCodeAt(int offset) const { return code[offset]; };
-    bool hasCodeAt(int offset) const { return offset < code.size(); };
+    int getSizeAt(int offset) const { return instructionSize(code[offset]); };
+    bool hasCodeAt(int offset) const { return offset < codeCount(); };
     int codeCount() const { return code.size(); };
     int tapeCount() const { return names.size(); };
 
-    std::optional<int> defineName(const std::string& name, int line);
-    std::optional<int> findName(const std::string& name) const;
+    // Names match in any case; they are kept in upper case.
+    std::optional<int> defineName(std::string_view name, int line);
+    Symbol* findName(std::string_view name) { return names.find(name); };
+    const Symbol* findName(std::string_view name) const { return names.find(name); };
+
+    void decode(int from, std::vector<DecodedInstruction>& out) const;
+
+    void serialize(std::string& out) const;
+    bool deserialize(const uint8_t* data, size_t size);
 
-    void disassemble(const std::string& name);
-    int disassembleInstructionAt(int offset);
+    void disassemble(const std::string& name) const;
+    int disassembleInstructionAt(int offset) const;
 
     void write(uint8_t byte, int line);
     void write(OpCode opcode, int line);
-    void patchJump(int tape, int offset);
+    void write(OpCode opcode, int tape, int line);
+    void write(OpCode opcode, int tape, int other, int line);
+    int beginLoop(int tape, int line);
+    void endLoop(int loopStart, int line);
 
+    void truncate(int offset);
+    void truncateNames(int count);
     void clear();
 };
@@ -0,0 +1,376 @@
+#include "jit.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+#define QUICKCHAT_JIT_X86_64
+#endif
+
+// Register use in compiled code (System V x86-64):
+//   r12  JitTape array, so a tape's cell is always [r12 + tape * 24]
+//   r13  JitContext
+//   rax, rcx, rdx, rsi, rdi  scratch, nothing lives across instructions
+// Compiled code returns the index of the instruction it stopped at: the
+// final HALT, or an instruction about to fail. In the second case nothing
+// has been changed yet, so the interpreter can run that instruction again
+// and report the error exactly as it always has.
+
+static const uint8_t JE = 0x84;
+static const uint8_t JNE = 0x85;
+static const uint8_t JB = 0x82;
+static const uint8_t JAE = 0x83;
+static const uint8_t JB8 = 0x72;
+static const uint8_t JZ8 = 0x74;
+
+static const uint8_t RAX = 0;
+static const uint8_t RDX = 2;
+
+static const uint8_t HOST_OUTPUT = 1;
+static const uint8_t HOST_INPUT = 2;
+static const uint8_t HOST_RESET = 3;
+static const uint8_t HOST_RESERVE = 4;
+static const uint8_t HOST_SCAN = 5;
+
+static int32_t tapeOffset(int tape)
+{
+    return tape * static_cast<int32_t>(sizeof(JitTape));
+}
+
+bool Jit::supported()
+{
+#ifdef QUICKCHAT_JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Jit::emit(std::initializer_list<uint8_t> bytes)
+{
+    buffer.insert(buffer.end(), bytes);
+}
+
+void Jit::emit32(uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        buffer.push_back((value >> (8 * i)) & 0xFF);
+    }
+}
+
+void Jit::emit64(uint64_t value)
+{
+    emit32(value & 0xFFFFFFFF);
+    emit32(value >> 32);
+}
+
+// mov reg, [r12 + tape * 24]
+void Jit::loadCell(uint8_t reg, int tape)
+{
+    emit({ 0x49, 0x8B, static_cast<uint8_t>(0x84 | (reg << 3)), 0x24 });
+    emit32(tapeOffset(tape));
+}
+
+// Short forward jump within one template; returns where to patch it.
+size_t Jit::skip(uint8_t condition)
+{
+    emit({ condition, 0x00 });
+    return buffer.size();
+}
+
+void Jit::land(size_t from)
+{
+    buffer[from - 1] = static_cast<uint8_t>(buffer.size() - from);
+}
+
+// Moves a tape's pointer right by 'count', asking the host to grow the
+// tape first when that would pass the end of its storage:
+//   mov rax, [r12 + tape]; add rax, count; cmp rax, [r12 + tape + 16]
+//   jb store; <reserve>; mov rax, [r12 + tape]; add rax, count
+//   store: mov [r12 + tape], rax
+void Jit::moveRight(int tape, int32_t count, uint32_t index)
+{
+    auto offset = tapeOffset(tape);
+    emit({ 0x49, 0x8B, 0x84, 0x24 }); emit32(offset);
+    emit({ 0x48, 0x05 }); emit32(count);
+    emit({ 0x49, 0x3B, 0x84, 0x24 }); emit32(offset + 16);
+    auto store = skip(JB8);
+    reserve(tape, count, index);
+    emit({ 0x49, 0x8B, 0x84, 0x24 }); emit32(offset);
+    emit({ 0x48, 0x05 }); emit32(count);
+    land(store);
+    emit({ 0x49, 0x89, 0x84, 0x24 }); emit32(offset);
+}
+
+// mov esi, tape; mov edx, cells; <call reserve>; test eax, eax; jnz bail
+void Jit::reserve(int tape, int32_t cells, uint32_t index)
+{
+    emit({ 0xBE }); emit32(tape);
+    emit({ 0xBA }); emit32(cells);
+    callHost(HOST_RESERVE);
+    emit({ 0x85, 0xC0 });
+    bailOut(JNE, index);
+}
+
+void Jit::jumpTo(uint8_t condition, uint32_t index)
+{
+    emit({ 0x0F, condition });
+    jumps.push_back({ buffer.size(), index });
+    emit32(0);
+}
+
+void Jit::bailOut(uint8_t condition, uint32_t index)
+{
+    emit({ 0x0F, condition });
+    bailouts.push_back({ buffer.size(), index });
+    emit32(0);
+}
+
+// mov rdi, [r13]; call [r13 + slot * 8]
+void Jit::callHost(uint8_t slot)
+{
+    emit({ 0x49, 0x8B, 0x7D, 0x00 });
+    emit({ 0x41, 0xFF, 0x55, static_cast<uint8_t>(slot * 8) });
+}
+
+void Jit::compileInstruction(const DecodedInstruction& instruction, uint32_t index, size_t tapeCount)
+{
+    auto tape = tapeOffset(instruction.tape);
+    switch (instruction.opcode)
+    {
+        case OpCode::INCPTR:
+            moveRight(instruction.tape, 1, index);
+            break;
+        case OpCode::DECPTR:
+            // mov rax, [r12 + tape]; cmp rax, [r12 + tape + 8]; je bail
+            // dec qword [r12 + tape]
+            emit({ 0x49, 0x8B, 0x84, 0x24 }); emit32(tape);
+            emit({ 0x49, 0x3B, 0x84, 0x24 }); emit32(tape + 8);
+            bailOut(JE, index);
+            emit({ 0x49, 0xFF, 0x8C, 0x24 }); emit32(tape);
+            break;
+        case OpCode::INCATPTR:
+            // inc byte [rax]
+            loadCell(RAX, instruction.tape);
+            emit({ 0xFE, 0x00 });
+            break;
+        case OpCode::DECATPTR:
+            // dec byte [rax]
+            loadCell(RAX, instruction.tape);
+            emit({ 0xFE, 0x08 });
+            break;
+        case OpCode::OUTPUT:
+            // movsx esi, byte [rax]
+            loadCell(RAX, instruction.tape);
+            emit({ 0x0F, 0xBE, 0x30 });
+            callHost(HOST_OUTPUT);
+            break;
+        case OpCode::INPUT:
+            // mov [rdx], al
+            callHost(HOST_INPUT);
+            loadCell(RDX, instruction.tape);
+            emit({ 0x88, 0x02 });
+            break;
+        case OpCode::BEGIN:
+        case OpCode::END:
+            // cmp byte [rax], 0
+            loadCell(RAX, instruction.tape);
+            emit({ 0x80, 0x38, 0x00 });
+            jumpTo(instruction.opcode == OpCode::BEGIN ? JE : JNE, instruction.jump);
+            break;
+        case OpCode::DEFINE_NAME:
+        case OpCode::DELETE_NAME:
+            // mov esi, tape; mov edx, joining
+            emit({ 0xBE }); emit32(instruction.tape);
+            emit({ 0xBA }); emit32(instruction.opcode == OpCode::DEFINE_NAME);
+            callHost(HOST_RESET);
+            break;
+        case OpCode::COPY_FROM:
+            // movzx ecx, byte [rax]; cmp ecx, tapeCount; jae bail
+            // lea rcx, [rcx + rcx * 2]; mov rdx, [r12 + rcx * 8]
+            // mov dl, [rdx]; mov [rax], dl
+            loadCell(RAX, instruction.tape);
+            emit({ 0x0F, 0xB6, 0x08 });
+            emit({ 0x81, 0xF9 }); emit32(static_cast<uint32_t>(tapeCount));
+            bailOut(JAE, index);
+            emit({ 0x48, 0x8D, 0x0C, 0x49 });
+            emit({ 0x49, 0x8B, 0x14, 0xCC });
+            emit({ 0x8A, 0x12 });
+            emit({ 0x88, 0x10 });
+            break;
+        case OpCode::ADD:
+            // add byte [rax], operand
+            loadCell(RAX, instruction.tape);
+            emit({ 0x80, 0x00, static_cast<uint8_t>(instruction.operand) });
+            break;
+        case OpCode::MOVE:
+            if (instruction.operand > 0)
+            {
+                moveRight(instruction.tape, instruction.operand, index);
+            }
+            else
+            {
+                // mov rax, [r12 + tape]; sub rax, [r12 + tape + 8]
+                // cmp rax, -operand; jb bail; sub qword [r12 + tape], -operand
+                emit({ 0x49, 0x8B, 0x84, 0x24 }); emit32(tape);
+                emit({ 0x49, 0x2B, 0x84, 0x24 }); emit32(tape + 8);
+                emit({ 0x48, 0x3D }); emit32(-instruction.operand);
+                bailOut(JB, index);
+                emit({ 0x49, 0x81, 0xAC, 0x24 }); emit32(tape);
+                emit32(-instruction.operand);
+            }
+            break;
+        case OpCode::SET_ZERO:
+            // mov byte [rax], 0
+            loadCell(RAX, instruction.tape);
+            emit({ 0xC6, 0x00, 0x00 });
+            break;
+        case OpCode::MUL_ADD:
+        {
+            // movzx eax, byte [rax]; test eax, eax; jz done
+            // mov rdx, [r12 + other]; add rdx, offset
+            // cmp rdx, [r12 + other + 16]; jb add; <reserve>
+            // add: movzx eax, byte [rax]; imul eax, eax, factor
+            // add [rdx + offset], al
+            // done:
+            auto other = tapeOffset(instruction.other);
+            loadCell(RAX, instruction.tape);
+            emit({ 0x0F, 0xB6, 0x00 });
+            emit({ 0x85, 0xC0 });
+            auto done = skip(JZ8);
+            emit({ 0x49, 0x8B, 0x94, 0x24 }); emit32(other);
+            emit({ 0x48, 0x81, 0xC2 }); emit32(instruction.offset);
+            emit({ 0x49, 0x3B, 0x94, 0x24 }); emit32(other + 16);
+            auto add = skip(JB8);
+            reserve(instruction.other, instruction.offset, index);
+            land(add);
+            loadCell(RAX, instruction.tape);
+            emit({ 0x0F, 0xB6, 0x00 });
+            emit({ 0x69, 0xC0 }); emit32(instruction.operand);
+            loadCell(RDX, instruction.other);
+            emit({ 0x00, 0x82 }); emit32(instruction.offset);
+            land(done);
+            break;
+        }
+        case OpCode::SCAN:
+            // mov esi, tape; mov edx, stride; <call scan>
+            // test eax, eax; jnz bail
+            emit({ 0xBE }); emit32(instruction.tape);
+            emit({ 0xBA }); emit32(instruction.operand);
+            callHost(HOST_SCAN);
+            emit({ 0x85, 0xC0 });
+            bailOut(JNE, index);
+            break;
+        case OpCode::INCPTR_UNCHECKED:
+        case OpCode::DECPTR_UNCHECKED:
+        case OpCode::MOVE_UNCHECKED:
+        {
+            // add qword [r12 + tape], move
+            auto move = instruction.opcode == OpCode::MOVE_UNCHECKED ? instruction.operand
+                : instruction.opcode == OpCode::INCPTR_UNCHECKED ? 1 : -1;
+            emit({ 0x49, 0x81, 0x84, 0x24 }); emit32(tape);
+            emit32(move);
+            break;
+        }
+        case OpCode::COPY_FROM_UNCHECKED:
+            // movzx ecx, byte [rax]; lea rcx, [rcx + rcx * 2]
+            // mov rdx, [r12 + rcx * 8]; mov dl, [rdx]; mov [rax], dl
+            loadCell(RAX, instruction.tape);
+            emit({ 0x0F, 0xB6, 0x08 });
+            emit({ 0x48, 0x8D, 0x0C, 0x49 });
+            emit({ 0x49, 0x8B, 0x14, 0xCC });
+            emit({ 0x8A, 0x12 });
+            emit({ 0x88, 0x10 });
+            break;
+        case OpCode::MUL_ADD_UNCHECKED:
+            // movzx eax, byte [rax]; imul eax, eax, factor
+            // add [rdx + offset], al
+            loadCell(RAX, instruction.tape);
+            emit({ 0x0F, 0xB6, 0x00 });
+            emit({ 0x69, 0xC0 }); emit32(instruction.operand);
+            loadCell(RDX, instruction.other);
+            emit({ 0x00, 0x82 }); emit32(instruction.offset);
+            break;
+        case OpCode::HALT:
+            // mov eax, index, then fall into the epilogue.
+            emit({ 0xB8 }); emit32(index);
+            break;
+    }
+}
+
+bool Jit::compile(const std::vector<DecodedInstruction>& program, uint32_t from, size_t tapeCount)
+{
+#ifdef QUICKCHAT_JIT_X86_64
+    release();
+    buffer.clear();
+    labels.clear();
+    jumps.clear();
+    bailouts.clear();
+    first = from;
+
+    // push rbx; push r12; push r13 (keeps calls 16-byte aligned)
+    // mov r13, rdi; mov r12, rsi
+    emit({ 0x53, 0x41, 0x54, 0x41, 0x55 });
+    emit({ 0x49, 0x89, 0xFD, 0x49, 0x89, 0xF4 });
+
+    for (auto index = from; index < program.size(); index++)
+    {
+        labels.push_back(buffer.size());
+        compileInstruction(program[index], index, tapeCount);
+    }
+
+    // pop r13; pop r12; pop rbx; ret
+    auto epilogue = buffer.size();
+    emit({ 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3 });
+
+    auto patch = [this](size_t at, size_t target)
+    {
+        auto relative = static_cast<uint32_t>(target - (at + 4));
+        memcpy(&buffer[at], &relative, sizeof(relative));
+    };
+
+    for (const auto& jump : jumps)
+    {
+        if (jump.second < first || jump.second - first >= labels.size()) return false;
+        patch(jump.first, labels[jump.second - first]);
+    }
+
+    // mov eax, index; jmp epilogue
+    for (const auto& bailout : bailouts)
+    {
+        patch(bailout.first, buffer.size());
+        emit({ 0xB8 }); emit32(bailout.second);
+        emit({ 0xE9 }); emit32(0);
+        patch(buffer.size() - 4, epilogue);
+    }
+
+    auto memory = mmap(nullptr, buffer.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return false;
+    memcpy(memory, buffer.data(), buffer.size());
+    if (mprotect(memory, buffer.size(), PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, buffer.size());
+        return false;
+    }
+    code = memory;
+    codeSize = buffer.size();
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint32_t Jit::run(JitContext& context, JitTape* tapes)
+{
+    using Entry = uint32_t (*)(JitContext*, JitTape*);
+    return reinterpret_cast<Entry>(code)(&context, tapes);
+}
+
+void Jit::release()
+{
+#ifdef QUICKCHAT_JIT_X86_64
+    if (code != nullptr) munmap(code, codeSize);
+#endif
+    code = nullptr;
+    codeSize = 0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "instruction.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+// What compiled code sees of a tape. The VM fills these in before a run
+// and reads the pointers back afterwards.
+struct JitTape
+{
+    char* cell;
+    char* begin;
+    char* end;
+};
+
+// Calls back into the host for anything that is not plain tape arithmetic.
+// The layout is fixed: compiled code reads these fields by offset.
+struct JitContext
+{
+    void* host;
+    void (*output)(void* host, int value);
+    int (*input)(void* host);
+    void (*reset)(void* host, int tape, int joining);
+    // These return nonzero to leave the instruction to the interpreter.
+    int (*reserve)(void* host, int tape, int cells);
+    int (*scan)(void* host, int tape, int stride);
+};
+
+class Jit
+{
+private:
+    std::vector<uint8_t> buffer;
+    std::vector<size_t> labels;
+    std::vector<std::pair<size_t, uint32_t>> jumps;
+    std::vector<std::pair<size_t, uint32_t>> bailouts;
+    void* code;
+    size_t codeSize;
+    uint32_t first;
+
+    void emit(std::initializer_list<uint8_t> bytes);
+    void emit32(uint32_t value);
+    void emit64(uint64_t value);
+    void loadCell(uint8_t reg, int tape);
+    void jumpTo(uint8_t condition, uint32_t index);
+    void bailOut(uint8_t condition, uint32_t index);
+    void callHost(uint8_t slot);
+    size_t skip(uint8_t condition);
+    void land(size_t from);
+    void moveRight(int tape, int32_t count, uint32_t index);
+    void reserve(int tape, int32_t cells, uint32_t index);
+
+    void compileInstruction(const DecodedInstruction& instruction, uint32_t index, size_t tapeCount);
+    void release();
+public:
+    Jit(): code(nullptr), codeSize(0), first(0) {};
+    ~Jit() { release(); };
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    static bool supported();
+    bool compile(const std::vector<DecodedInstruction>& program, uint32_t from, size_t tapeCount);
+    uint32_t run(JitContext& context, JitTape* tapes);
+};
@@ -1,7 +1,14 @@
 #include "lexer.hpp"
 
 const std::string charError = "Unexpected character.";
-std::unordered_map<std::string, TokenType> Lexer::tokenMap =
+
+struct Keyphrase
+{
+    std::string_view text;
+    TokenType type;
+};
+
+static constexpr Keyphrase keyphrases[] =
 {
     {"No problem.",         TokenType::NO_PROBLEM},
     {"Defending...",        TokenType::DEFENDING},
@@ -16,6 +23,38 @@ std::unordered_map<std::string, TokenType> Lexer::tokenMap =
     {"What a save!",        TokenType::WHAT_A_SAVE},
 };
 
+static const size_t KEYPHRASE_SLOTS = 32;
+static const size_t KEYPHRASE_MIN = 9;
+
+// The first and second to last characters add up differently for every
+// keyphrase, so a lookup is one hash and one comparison.
+static constexpr size_t keyphraseHash(std::string_view text)
+{
+    return (static_cast<unsigned char>(text[0]) + static_cast<unsigned char>(text[text.size() - 2])) % KEYPHRASE_SLOTS;
+}
+
+struct KeyphraseTable
+{
+    Keyphrase slots[KEYPHRASE_SLOTS];
+    bool perfect;
+};
+
+static constexpr KeyphraseTable buildKeyphraseTable()
+{
+    KeyphraseTable table {};
+    table.perfect = true;
+    for (auto& keyphrase : keyphrases)
+    {
+        auto& slot = table.slots[keyphraseHash(keyphrase.text)];
+        if (!slot.text.empty()) table.perfect = false;
+        slot = keyphrase;
+    }
+    return table;
+}
+
+static constexpr KeyphraseTable keyphraseTable = buildKeyphraseTable();
+static_assert(keyphraseTable.perfect, "keyphraseHash must give every keyphrase its own slot");
+
 static bool isDigit(char c)
 {
     return c >= '0' && c <= '9';
@@ -97,8 +136,7 @@ bool Lexer::match(char expected)
 
 Token Lexer::makeToken(enum TokenType type)
 {
-    auto text = std::string_view(&source[start], current - start);
-    return Token(type, text, line);
+    return Token(type, source.substr(start, current - start), line);
 }
 
 Token Lexer::errorToken(const std::string& message)
@@ -106,29 +144,29 @@ Token Lexer::errorToken(const std::string& message)
     return Token(TokenType::_ERROR, message, line);
 }
 
+// A keyphrase has to fill the whole run of words and punctuation after
+// 'start'; otherwise only the first word counts, as a name.
 Token Lexer::identifierOrKeyphrase()
 {
-    bool oneWord = true;
-    int keyphrase = 1;
-    int id = 1;
-    while (isAlpha(source[start + keyphrase])
-        || isDigit(source[start + keyphrase])
-        || isPunctuation(source[start + keyphrase]))
+    auto end = start + 1;
+    auto word = std::string_view::npos;
+    while (end < source.size() && (isAlpha(source[end]) || isDigit(source[end]) || isPunctuation(source[end])))
     {
-        if (isPunctuation(source[start + keyphrase])) oneWord = false;
-        if (oneWord) id++;
-        keyphrase++;
+        if (word == std::string_view::npos && isPunctuation(source[end])) word = end;
+        end++;
     }
 
-    auto search = tokenMap.find(source.substr(start, keyphrase));
-    if (search != tokenMap.end())
+    auto run = source.substr(start, end - start);
+    if (run.size() >= KEYPHRASE_MIN)
     {
-        current += keyphrase - 1;
-        return makeToken(search->second);
-    }
-    else
-    {
-        current += id - 1;
-        return makeToken(TokenType::IDENTIFIER);
+        auto& slot = keyphraseTable.slots[keyphraseHash(run)];
+        if (slot.text == run)
+        {
+            current = end;
+            return makeToken(slot.type);
+        }
     }
+
+    current = word == std::string_view::npos ? end : word;
+    return makeToken(TokenType::IDENTIFIER);
 }
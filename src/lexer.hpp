@@ -1,7 +1,7 @@
 #pragma once
 
 #include <string>
-#include <unordered_map>
+#include <string_view>
 
 enum class TokenType
 {
@@ -42,9 +42,9 @@ struct Token
 class Lexer
 {
 private:
-    std::string source;
-    int start;
-    int current;
+    std::string_view source;
+    size_t start;
+    size_t current;
     int line;
 
     bool isAtEnd();
@@ -56,10 +56,10 @@ private:
     Token makeToken(enum TokenType type);
     Token errorToken(const std::string& message);
 
-    static std::unordered_map<std::string, TokenType> tokenMap;
     Token identifierOrKeyphrase();
 public:
-    Lexer(const std::string& source)
+    // Tokens point into 'source', which has to outlive them.
+    Lexer(std::string_view source)
         : source(source), start(0), current(0), line(1) {};
     Token scanToken();
 };
@@ -1,19 +1,66 @@
+#include "batch.hpp"
+#include "cache.hpp"
 #include "instruction.hpp"
+#include "lexer.hpp"
+#include "mapped_file.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
 #include "vm.hpp"
+#include "emitter.hpp"
 #include <cstdarg>
-#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+// Loops opened minus loops closed on 'line'.
+static int loopBalance(const std::string& line)
+{
+    auto lexer = Lexer(line);
+    int balance = 0;
+    for (auto token = lexer.scanToken(); token.type != TokenType::_EOF; token = lexer.scanToken())
+    {
+        if (token.type == TokenType::TAKE_THE_SHOT) balance++;
+        else if (token.type == TokenType::WHAT_A_SAVE) balance--;
+    }
+    return balance;
+}
 
+// Lines are held back until every loop they open has been closed, then
+// compiled and run together. Nothing can jump back into a fragment that
+// has finished, so its code is dropped and a long session doesn't grow.
 static void repl(VM& vm)
 {
     std::string line;
+    std::string fragment;
+    int depth = 0;
+
+    // Scripts read from the same stdin as the prompt, so block reads would
+    // swallow the lines that follow.
+    vm.setUnbuffered(true);
 
     while (true)
     {
-        std::cout << "quickchat> ";
+        std::cout << (depth > 0 ? "     ...> " : "quickchat> ");
         std::getline(std::cin, line);
 
-        vm.interpret(line + "\r\n");
+        if (!line.empty())
+        {
+            fragment += line + "\r\n";
+            depth += loopBalance(line);
+        }
+
+        if (!fragment.empty() && (depth <= 0 || std::cin.eof()))
+        {
+            vm.interpret(fragment);
+            vm.discard();
+            fragment.clear();
+            depth = 0;
+        }
 
         if (std::cin.eof())
         {
@@ -23,63 +70,311 @@ static void repl(VM& vm)
     }
 }
 
-static std::string readFile(const std::string& path)
+// Loads the program from its cache file when the source hasn't changed,
+// otherwise compiles it and refreshes the cache.
+static void compileFile(VM& vm, Instructions& instructions, const std::string& path, bool useCache)
 {
-    std::ifstream t(path);
-    if (!t.is_open())
+    MappedFile file;
+    if (!file.open(path))
     {
         std::cout << "Failed to open " << path << std::endl;
         exit(74);
     }
-    std::string str;
 
-    t.seekg(0, std::ios::end);
-    try
+    auto source = file.view();
+    if (!useCache)
     {
-        str.reserve(t.tellg());
+        if (!vm.compile(source)) exit(65);
+        return;
     }
-    catch(std::length_error err)
+
+    auto cache = BytecodeCache(path, source, vm.getCellBits());
+    if (cache.load(instructions)) return;
+
+    if (!vm.compile(source)) exit(65);
+    cache.save(instructions);
+}
+
+// The report goes to stderr so it never mixes with the program's output.
+// A run that fails still gets one, for everything up to the failure.
+static void writeProfile(const VM& vm, const Instructions& instructions, const std::string& jsonPath)
+{
+    auto profiler = Profiler(instructions, vm.getProgram(), vm.getProfile());
+    profiler.report(std::cerr, PROFILE_REPORT_LINES);
+    if (jsonPath.empty()) return;
+
+    std::ofstream json(jsonPath);
+    if (!json.is_open())
     {
-        std::cout << "File is too long" << std::endl;
+        std::cerr << "Failed to open " << jsonPath << std::endl;
         exit(74);
     }
-    t.seekg(0, std::ios::beg);
-
-    str.assign((std::istreambuf_iterator<char>(t)),
-                std::istreambuf_iterator<char>());
-
-    return str;
+    profiler.writeJson(json);
 }
 
-static void runFile(VM& vm, const std::string& path)
+static void runFile(VM& vm, Instructions& instructions, const std::string& path, bool useCache, bool profile, const std::string& profileJson, const std::string& tracePath)
 {
-    std::string source = readFile(path);
-    InterpretResult result = vm.interpret(source);
+    compileFile(vm, instructions, path, useCache);
+    vm.setProfiling(profile);
+
+    TraceWriter trace;
+    if (!tracePath.empty())
+    {
+        if (!trace.open(tracePath, instructions, vm.getCellBits()))
+        {
+            std::cerr << "Failed to open " << tracePath << std::endl;
+            exit(74);
+        }
+        vm.setTrace(&trace);
+    }
+
+    InterpretResult result = vm.run();
+    if (profile) writeProfile(vm, instructions, profileJson);
+    if (!tracePath.empty() && !trace.finish())
+    {
+        std::cerr << "Failed to write " << tracePath << std::endl;
+        exit(74);
+    }
 
     switch (result)
     {
         case InterpretResult::COMPILE_ERROR: exit(65);
         case InterpretResult::OK: break;
-        case InterpretResult::RUNTIME_ERROR: exit(70);
+        case InterpretResult::RUNTIME_ERROR:
+        case InterpretResult::LIMIT_REACHED:
+        case InterpretResult::SUSPENDED:
+            exit(70);
+    }
+}
+
+static void emitC(VM& vm, Instructions& instructions, const std::string& path, size_t tapeLimit, bool useCache)
+{
+    compileFile(vm, instructions, path, useCache);
+
+    CEmitter(instructions, std::cout, tapeLimit).emit(path);
+}
+
+// Plays a trace written by --trace up to 'step', or to its end, and prints
+// the tapes as they were then.
+static void replay(const std::string& path, uint64_t step)
+{
+    TraceReplay trace;
+    if (!trace.open(path))
+    {
+        std::cerr << "Failed to open " << path << " as a trace" << std::endl;
+        exit(74);
+    }
+
+    while (trace.stepCount() < step && trace.step())
+    {
     }
+    if (trace.isMalformed())
+    {
+        std::cerr << "The trace is damaged after step " << trace.stepCount() << "." << std::endl;
+        exit(65);
+    }
+    if (step != UINT64_MAX && trace.stepCount() < step)
+    {
+        std::cerr << "The trace ends at step " << trace.stepCount() << "." << std::endl;
+        exit(65);
+    }
+
+    trace.report();
+}
+
+// Runs every .qc file in 'dir'. Outputs are printed in file name order,
+// each under a header, and every error line is tagged with its script.
+// The exit code is the worst of the scripts'.
+static int runBatch(const std::string& dir, const BatchOptions& options, size_t threads)
+{
+    std::vector<std::string> paths;
+    std::error_code error;
+    for (auto& entry : std::filesystem::directory_iterator(dir, error))
+    {
+        if (entry.is_regular_file() && entry.path().extension() == ".qc") paths.push_back(entry.path().string());
+    }
+    if (error)
+    {
+        std::cerr << "Failed to open " << dir << std::endl;
+        return 74;
+    }
+    std::sort(paths.begin(), paths.end());
+
+    int status = 0;
+    int failed = 0;
+    auto runner = BatchRunner(paths, options, threads);
+    for (auto& result : runner.run())
+    {
+        std::cout << "== " << result.path << " ==" << std::endl;
+        std::cout << result.output;
+        std::cout.flush();
+
+        std::istringstream errors(result.errors);
+        for (std::string line; std::getline(errors, line);)
+        {
+            std::cerr << result.path << ": " << line << std::endl;
+        }
+
+        if (result.status != 0) failed++;
+        status = std::max(status, result.status);
+    }
+
+    std::cerr << paths.size() << " scripts, " << failed << " failed" << std::endl;
+    return status;
+}
+
+static void usage()
+{
+    std::cerr << "Usage: quickchat [--jit] [--unbuffered] [--tape-limit cells] [--cell-bits 8|16|32] [--unchecked] [--emit-c] [--no-cache] [--profile] [--profile-json file] [--fuel instructions] [--time-limit ms] [--trace file] [--batch dir [-j threads]] [path]" << std::endl;
+    std::cerr << "       quickchat --replay file [--step n]" << std::endl;
+    exit(64);
 }
 
 int main(int argc, const char* argv[])
 {
     auto instructions = Instructions();
     auto vm = VM(instructions);
+    const char* path = nullptr;
+    bool emit = false;
+    bool useCache = true;
+    bool profile = false;
+    std::string profileJson;
+    std::string tracePath;
+    const char* replayPath = nullptr;
+    uint64_t step = UINT64_MAX;
+    size_t tapeLimit = DEFAULT_TAPE_LIMIT;
+    int cellBits = DEFAULT_CELL_BITS;
+    bool unchecked = false;
+    uint64_t fuel = 0;
+    std::chrono::milliseconds timeLimit(0);
+    bool jit = false;
+    const char* batch = nullptr;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
 
-    if (argc == 1)
+    for (int i = 1; i < argc; i++)
     {
-        repl(vm);
+        auto arg = std::string(argv[i]);
+        if (arg == "--jit")
+        {
+            jit = true;
+            vm.setJit(true);
+        }
+        else if (arg == "--unbuffered")
+        {
+            vm.setUnbuffered(true);
+        }
+        else if (arg == "--tape-limit" && i + 1 < argc)
+        {
+            char* end;
+            auto limit = strtoull(argv[++i], &end, 10);
+            if (*end != '\0' || limit == 0) usage();
+            tapeLimit = limit;
+            vm.setTapeLimit(tapeLimit);
+        }
+        else if (arg == "--cell-bits" && i + 1 < argc)
+        {
+            auto bits = std::string(argv[++i]);
+            if (bits != "8" && bits != "16" && bits != "32") usage();
+            cellBits = std::stoi(bits);
+            vm.setCellBits(cellBits);
+        }
+        else if (arg == "--unchecked")
+        {
+            unchecked = true;
+            vm.setUnchecked(true);
+        }
+        else if (arg == "--emit-c")
+        {
+            emit = true;
+        }
+        else if (arg == "--no-cache")
+        {
+            useCache = false;
+        }
+        else if (arg == "--profile")
+        {
+            profile = true;
+        }
+        else if (arg == "--profile-json" && i + 1 < argc)
+        {
+            profile = true;
+            profileJson = argv[++i];
+        }
+        else if (arg == "--fuel" && i + 1 < argc)
+        {
+            char* end;
+            fuel = strtoull(argv[++i], &end, 10);
+            if (*end != '\0' || fuel == 0) usage();
+            vm.setFuel(fuel);
+        }
+        else if (arg == "--time-limit" && i + 1 < argc)
+        {
+            char* end;
+            timeLimit = std::chrono::milliseconds(strtoull(argv[++i], &end, 10));
+            if (*end != '\0' || timeLimit.count() == 0) usage();
+            vm.setTimeLimit(timeLimit);
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            tracePath = argv[++i];
+        }
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            replayPath = argv[++i];
+        }
+        else if (arg == "--step" && i + 1 < argc)
+        {
+            char* end;
+            step = strtoull(argv[++i], &end, 10);
+            if (*end != '\0' || argv[i][0] == '\0') usage();
+        }
+        else if (arg == "--batch" && i + 1 < argc)
+        {
+            batch = argv[++i];
+        }
+        else if (arg == "-j" && i + 1 < argc)
+        {
+            char* end;
+            threads = strtoull(argv[++i], &end, 10);
+            if (*end != '\0' || threads == 0) usage();
+        }
+        else if (path == nullptr && arg.rfind("--", 0) != 0)
+        {
+            path = argv[i];
+        }
+        else
+        {
+            usage();
+        }
+    }
+
+    if (replayPath != nullptr)
+    {
+        if (path != nullptr || emit || profile || !tracePath.empty() || batch != nullptr) usage();
+        replay(replayPath, step);
     }
-    else if (argc == 2)
+    else if (step != UINT64_MAX)
     {
-        runFile(vm, argv[1]);
+        usage();
+    }
+    else if (batch != nullptr)
+    {
+        if (path != nullptr || emit || profile || !tracePath.empty()) usage();
+        return runBatch(batch, { jit, useCache, tapeLimit, cellBits, unchecked, fuel, timeLimit }, threads);
+    }
+    else if (emit)
+    {
+        // The C has checked 8-bit cells.
+        if (path == nullptr || !tracePath.empty() || cellBits != 8 || unchecked) usage();
+        emitC(vm, instructions, path, tapeLimit, useCache);
+    }
+    else if (path == nullptr)
+    {
+        if (!tracePath.empty()) usage();
+        repl(vm);
     }
     else
     {
-        std::cerr << "Usage: quickchat [path]" << std::endl;
-        exit(64);
+        runFile(vm, instructions, path, useCache, profile, profileJson, tracePath);
     }
 }
@@ -0,0 +1,58 @@
+#include "mapped_file.hpp"
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define QUICKCHAT_MMAP
+#endif
+
+MappedFile::~MappedFile()
+{
+#ifdef QUICKCHAT_MMAP
+    if (mapped) munmap(const_cast<char*>(data), size);
+#endif
+}
+
+bool MappedFile::open(const std::string& path)
+{
+#ifdef QUICKCHAT_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || S_ISDIR(info.st_mode))
+    {
+        close(fd);
+        return false;
+    }
+
+    // mmap refuses empty files, and pipes or devices have no size to map;
+    // both fall through to the plain read below.
+    if (S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED)
+        {
+            close(fd);
+            madvise(address, info.st_size, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(address);
+            size = info.st_size;
+            mapped = true;
+            return true;
+        }
+    }
+    close(fd);
+#endif
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    buffer.assign((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    data = buffer.data();
+    size = buffer.size();
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Read-only view of a whole file. Mapped straight into memory where the
+// platform allows it, read into a buffer everywhere else.
+class MappedFile
+{
+private:
+    const char* data;
+    size_t size;
+    bool mapped;
+    std::string buffer;
+public:
+    MappedFile(): data(nullptr), size(0), mapped(false) {};
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    std::string_view view() const { return std::string_view(data, size); };
+};
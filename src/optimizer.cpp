@@ -0,0 +1,374 @@
+#include "optimizer.hpp"
+#include <algorithm>
+#include <cstdlib>
+
+Optimizer::Optimizer(Instructions& instructions, int cellBits)
+    : instructions(instructions),
+    cellBits(cellBits),
+    code(std::vector<uint8_t>()),
+    lines(std::vector<int>()),
+    loopStarts(std::vector<int>())
+{
+}
+
+void Optimizer::load(int from)
+{
+    code.clear();
+    lines.clear();
+    loopStarts.clear();
+    for (int offset = from; instructions.hasCodeAt(offset); offset++)
+    {
+        code.push_back(instructions.getCodeAt(offset));
+        lines.push_back(instructions.getLineAt(offset));
+    }
+    instructions.truncate(from);
+}
+
+void Optimizer::optimize(int from)
+{
+    load(from);
+    for (int offset = 0; offset < codeCount();)
+    {
+        switch (getOpCodeAt(offset))
+        {
+            case OpCode::INCATPTR:
+            case OpCode::DECATPTR:
+                offset = foldCounts(offset);
+                break;
+            case OpCode::INCPTR:
+            case OpCode::DECPTR:
+                offset = foldMoves(offset);
+                break;
+            default:
+                copyInstruction(offset);
+                offset += getSizeAt(offset);
+                break;
+        }
+    }
+
+    // Loops are matched against the folded code, so a body like
+    // '<NAME>: No problem.' x3 is already a single ADD by now.
+    load(from);
+    for (int offset = 0; offset < codeCount();)
+    {
+        if (getOpCodeAt(offset) == OpCode::BEGIN)
+        {
+            offset = recognizeLoop(offset);
+        }
+        else
+        {
+            copyInstruction(offset);
+            offset += getSizeAt(offset);
+        }
+    }
+}
+
+// Replaces an innermost loop with a SCAN, or with MUL_ADDs followed by a
+// SET_ZERO, when its body allows it. Anything else is copied through and
+// its inner loops get their turn as the caller walks into them.
+int Optimizer::recognizeLoop(int offset)
+{
+    int end = offset + getSizeAt(offset);
+    while (end < codeCount() && getOpCodeAt(end) != OpCode::END)
+    {
+        if (getOpCodeAt(end) == OpCode::BEGIN) break;
+        end += getSizeAt(end);
+    }
+
+    if (end < codeCount() && getOpCodeAt(end) == OpCode::END)
+    {
+        if (scanLoop(offset) || linearLoop(offset, end))
+        {
+            return end + getSizeAt(end);
+        }
+    }
+
+    copyInstruction(offset);
+    return offset + getSizeAt(offset);
+}
+
+// '<NAME>: Take the shot!' around a single pointer move on the same tape
+// walks the pointer until it lands on a zero cell.
+bool Optimizer::scanLoop(int offset)
+{
+    auto tape = getTapeAt(offset);
+    int body = offset + getSizeAt(offset);
+    auto opcode = getOpCodeAt(body);
+    int stride;
+    switch (opcode)
+    {
+        case OpCode::INCPTR: stride = 1; break;
+        case OpCode::DECPTR: stride = -1; break;
+        case OpCode::MOVE: stride = static_cast<int8_t>(getCountAt(body)); break;
+        default: return false;
+    }
+
+    int size = getSizeAt(body);
+    if (getTapeAt(body) != tape) return false;
+    if (getOpCodeAt(body + size) != OpCode::END) return false;
+
+    instructions.write(OpCode::SCAN, tape, getLineAt(body));
+    instructions.write(static_cast<uint8_t>(stride), getLineAt(body + size - 1));
+    return true;
+}
+
+// Inverse of 'odd' modulo 2^32, and so modulo every narrower cell too.
+// Each step doubles the low bits that are right.
+static uint32_t inverse(uint32_t odd)
+{
+    uint32_t x = odd;
+    for (int i = 0; i < 4; i++)
+    {
+        x *= 2 - odd * x;
+    }
+    return x;
+}
+
+// A body that only adds to cells and leaves every pointer where it found
+// it runs a fixed number of times, decided by how much it changes the loop
+// cell each pass. Every other cell it touches just gains a multiple of the
+// loop cell's starting value, whichever tape it is on.
+bool Optimizer::linearLoop(int offset, int end)
+{
+    auto tape = getTapeAt(offset);
+    std::map<int, int> pointers;
+    std::vector<LoopTarget> targets;
+    std::vector<LoopReach> reaches;
+
+    // Notes the line of each move that takes a pointer further right than
+    // it has been yet.
+    auto moveTo = [&](int target, int body, int line)
+    {
+        if (pointers[target] <= 0) return;
+        auto reach = std::find_if(reaches.begin(), reaches.end(), [&](const LoopReach& r) { return r.tape == target; });
+        if (reach == reaches.end())
+        {
+            reaches.push_back({ target, std::vector<int>(), body, body });
+            reach = reaches.end() - 1;
+        }
+        if (static_cast<size_t>(pointers[target]) <= reach->lines.size()) return;
+        reach->lines.push_back(line);
+        reach->last = body;
+    };
+
+    auto addTo = [&](int target, int delta)
+    {
+        for (auto& cell : targets)
+        {
+            if (cell.tape == target && cell.offset == pointers[target])
+            {
+                cell.delta += delta;
+                return;
+            }
+        }
+        targets.push_back({ target, pointers[target], delta });
+    };
+
+    for (int body = offset + getSizeAt(offset); body < end; body += getSizeAt(body))
+    {
+        auto target = getTapeAt(body);
+        switch (getOpCodeAt(body))
+        {
+            case OpCode::INCATPTR: addTo(target, 1); break;
+            case OpCode::DECATPTR: addTo(target, -1); break;
+            case OpCode::ADD: addTo(target, static_cast<int8_t>(getCountAt(body))); break;
+            case OpCode::INCPTR:
+                pointers[target]++;
+                moveTo(target, body, getLineAt(body));
+                break;
+            case OpCode::DECPTR: pointers[target]--; break;
+            case OpCode::MOVE:
+            {
+                // A folded run of moves spreads its lines evenly from the
+                // first byte's to the last's.
+                int count = static_cast<int8_t>(getCountAt(body));
+                int first = getLineAt(body);
+                int step = count > 1 ? (getLineAt(body + getSizeAt(body) - 1) - first) / (count - 1) : 0;
+                for (int i = 0; i < std::abs(count); i++)
+                {
+                    pointers[target] += count > 0 ? 1 : -1;
+                    if (count > 0) moveTo(target, body, first + i * step);
+                }
+                break;
+            }
+            default: return false;
+        }
+        // Stepping left of the entry pointer could hit the underflow error,
+        // which only the interpreter reports properly.
+        if (pointers[target] < 0 || pointers[target] > UINT8_MAX) return false;
+    }
+
+    for (const auto& pointer : pointers)
+    {
+        if (pointer.second != 0) return false;
+    }
+
+    // The first pass would fail at whichever move first takes a pointer
+    // past the end of its tape. A MUL_ADD out at each tape's furthest cell
+    // checks for that before anything else, and works out the failing
+    // move's line the way a MOVE does, so those lines have to be evenly
+    // spread. The checks also have to go in the order the moves would
+    // have, so each tape must be done moving out before the next starts.
+    std::sort(reaches.begin(), reaches.end(), [](const LoopReach& a, const LoopReach& b) { return a.first < b.first; });
+    for (size_t i = 0; i < reaches.size(); i++)
+    {
+        auto& lines = reaches[i].lines;
+        int step = lines.size() > 1 ? (lines.back() - lines.front()) / static_cast<int>(lines.size() - 1) : 0;
+        for (size_t level = 0; level < lines.size(); level++)
+        {
+            if (lines[level] != lines.front() + static_cast<int>(level) * step) return false;
+        }
+        if (i > 0 && reaches[i - 1].last > reaches[i].first) return false;
+    }
+
+    int step = 0;
+    for (const auto& cell : targets)
+    {
+        if (cell.tape == tape && cell.offset == 0) step = cell.delta;
+    }
+    // An odd step always reaches zero; an even one might never.
+    if (step % 2 == 0) return false;
+
+    // Each factor is stored in a byte. Modulo 256 they all fit, but for
+    // wider cells it has to be small enough either way of zero.
+    auto mask = cellBits == 32 ? UINT32_MAX : (static_cast<uint32_t>(1) << cellBits) - 1;
+    auto factor = inverse(static_cast<uint32_t>(-step));
+    std::vector<int> scaled;
+    for (const auto& cell : targets)
+    {
+        auto product = factor * static_cast<uint32_t>(cell.delta) & mask;
+        auto value = product > mask / 2 ? -static_cast<int64_t>(mask - product) - 1 : static_cast<int64_t>(product);
+        if (cellBits > 8 && (value < INT8_MIN || value > INT8_MAX)) return false;
+        scaled.push_back(static_cast<int>(value));
+    }
+
+    // The checks add nothing unless the body does add to that cell too.
+    // Like a MOVE, each keeps the line of its first move in the opcode and
+    // that of its last in the rest.
+    auto line = getLineAt(offset);
+    std::vector<bool> written(targets.size(), false);
+    for (const auto& reach : reaches)
+    {
+        int furthest = reach.lines.size();
+        int factor = 0;
+        for (size_t i = 0; i < targets.size(); i++)
+        {
+            if (targets[i].tape == reach.tape && targets[i].offset == furthest)
+            {
+                factor = scaled[i];
+                written[i] = true;
+            }
+        }
+        instructions.write(OpCode::MUL_ADD, tape, reach.tape, reach.lines.front());
+        instructions.write(static_cast<uint8_t>(furthest), reach.lines.back());
+        instructions.write(static_cast<uint8_t>(factor), reach.lines.back());
+    }
+
+    for (size_t i = 0; i < targets.size(); i++)
+    {
+        auto& cell = targets[i];
+        if (cell.tape == tape && cell.offset == 0) continue;
+        if (scaled[i] == 0 || written[i]) continue;
+        instructions.write(OpCode::MUL_ADD, tape, cell.tape, line);
+        instructions.write(static_cast<uint8_t>(cell.offset), line);
+        instructions.write(static_cast<uint8_t>(scaled[i]), line);
+    }
+    instructions.write(OpCode::SET_ZERO, tape, line);
+    return true;
+}
+
+// Merges a run of INCATPTR/DECATPTR on one tape into a single ADD. The
+// opcode keeps the line of the first command and the count the line of
+// the last, like any other instruction spanning several bytes.
+int Optimizer::foldCounts(int offset)
+{
+    auto tape = getTapeAt(offset);
+    int end = offset;
+    int runLength = 0;
+    int count = 0;
+    // An ADD's count is a byte, which wraps along with 8-bit cells but has
+    // to stay in range for wider ones.
+    int maxRun = cellBits == 8 ? INT32_MAX : INT8_MAX;
+    while (end < codeCount() && runLength < maxRun && getTapeAt(end) == tape)
+    {
+        auto opcode = getOpCodeAt(end);
+        if (opcode == OpCode::INCATPTR) count++;
+        else if (opcode == OpCode::DECATPTR) count--;
+        else break;
+        runLength++;
+        end += getSizeAt(end);
+    }
+
+    if (runLength == 1)
+    {
+        copyInstruction(offset);
+    }
+    else if (cellBits == 8 ? count % 256 != 0 : count != 0)
+    {
+        instructions.write(OpCode::ADD, tape, getLineAt(offset));
+        instructions.write(static_cast<uint8_t>(count), getLineAt(end - 1));
+    }
+    return end;
+}
+
+// Merges a run of pointer moves in one direction on one tape into a single
+// MOVE. Runs only grow while the source lines step by a constant 0 or 1,
+// so the VM can recover the line of whichever move would have failed from
+// the first and last line alone.
+int Optimizer::foldMoves(int offset)
+{
+    auto opcode = getOpCodeAt(offset);
+    auto tape = getTapeAt(offset);
+    int sign = opcode == OpCode::INCPTR ? 1 : -1;
+    int previous = offset;
+    int end = offset + getSizeAt(offset);
+    int count = 1;
+    int lastStep = 0;
+    while (end < codeCount() && count < INT8_MAX
+        && getOpCodeAt(end) == opcode
+        && getTapeAt(end) == tape)
+    {
+        int step = getLineAt(end) - getLineAt(previous);
+        if (step != 0 && step != 1) break;
+        if (count > 1 && step != lastStep) break;
+        lastStep = step;
+        previous = end;
+        count++;
+        end += getSizeAt(end);
+    }
+
+    if (count == 1)
+    {
+        copyInstruction(offset);
+    }
+    else
+    {
+        instructions.write(OpCode::MOVE, tape, getLineAt(offset));
+        instructions.write(static_cast<uint8_t>(sign * count), getLineAt(end - 1));
+    }
+    return end;
+}
+
+void Optimizer::copyInstruction(int offset)
+{
+    // Folding can shrink a loop enough to go back to narrow jumps, so
+    // loops are rebuilt rather than copied byte for byte.
+    switch (getOpCodeAt(offset))
+    {
+        case OpCode::BEGIN:
+            loopStarts.push_back(instructions.beginLoop(getTapeAt(offset), getLineAt(offset)));
+            break;
+        case OpCode::END:
+            instructions.endLoop(loopStarts.back(), getLineAt(offset));
+            loopStarts.pop_back();
+            break;
+        default:
+        {
+            for (int i = 0; i < getSizeAt(offset); i++)
+            {
+                instructions.write(getCodeAt(offset + i), getLineAt(offset + i));
+            }
+            break;
+        }
+    }
+}
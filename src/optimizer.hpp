@@ -0,0 +1,55 @@
+#pragma once
+
+#include "instruction.hpp"
+#include <cstdint>
+#include <vector>
+#include <map>
+
+// One cell a loop body adds to, relative to the tape's pointer on entry.
+struct LoopTarget
+{
+    int tape;
+    int offset;
+    int delta;
+};
+
+// How far a loop body moves one tape's pointer right of where it started,
+// with the line of the move that first reaches each cell out to there.
+struct LoopReach
+{
+    int tape;
+    std::vector<int> lines;
+    int first;      // Where in the body the pointer first leaves its cell,
+    int last;       // and where it first gets furthest.
+};
+
+class Optimizer
+{
+private:
+    Instructions& instructions;
+    int cellBits;
+    std::vector<uint8_t> code;
+    std::vector<int> lines;
+    std::vector<int> loopStarts;
+
+    int codeCount() const { return code.size(); };
+    uint8_t getCodeAt(int offset) const { return code[offset]; };
+    int getLineAt(int offset) const { return lines[offset]; };
+    OpCode getOpCodeAt(int offset) const { return opCodeOf(code[offset]); };
+    int getSizeAt(int offset) const { return instructionSize(code[offset]); };
+    int getTapeAt(int offset) const { return tapeOf(&code[offset]); };
+    uint8_t getCountAt(int offset) const { return code[offset + getSizeAt(offset) - 1]; };
+
+    void load(int from);
+
+    int foldCounts(int offset);
+    int foldMoves(int offset);
+    int recognizeLoop(int offset);
+    bool scanLoop(int offset);
+    bool linearLoop(int offset, int end);
+    void copyInstruction(int offset);
+public:
+    // Counts and factors are folded modulo the cell width, 'cellBits'.
+    Optimizer(Instructions& instructions, int cellBits);
+    void optimize(int from);
+};
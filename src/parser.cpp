@@ -1,4 +1,5 @@
 #include "parser.hpp"
+#include "chunked_parser.hpp"
 #include <iostream>
 #include <cstdarg>
 #include <optional>
@@ -6,15 +7,15 @@
 
 //#define DEBUG_PRINT_CODE
 
-static int lastTape = 0;
-
-Parser::Parser(const std::string& source, Instructions& instructions)
-    : current(Token(TokenType::_EOF, source, 0)),
+Parser::Parser(std::string_view source, Instructions& instructions, std::ostream& errors)
+    : source(source),
+    current(Token(TokenType::_EOF, source, 0)),
     previous(Token(TokenType::_EOF, source, 0)),
     lexer(Lexer(source)),
     instructions(instructions),
+    errors(errors),
     loopLevel(0),
-    deleted(std::unordered_set<std::string>()),
+    lastTape(0),
     hadError(false),
     panicMode(false)
 {
@@ -25,11 +26,11 @@ void Parser::errorAt(const Token& token, const std::string& message)
 {
     if (panicMode) return;
     panicMode = true;
-    std::cerr << "[line " << token.line << "] Error";
+    errors << "[line " << token.line << "] Error";
 
     if (token.type == TokenType::_EOF)
     {
-        std::cerr << " at end";
+        errors << " at end";
     }
     else if (token.type == TokenType::_ERROR)
     {
@@ -37,14 +38,14 @@ void Parser::errorAt(const Token& token, const std::string& message)
     }
     else if (token.type == TokenType::NEW_LINE)
     {
-        std::cerr << " at end of line";
+        errors << " at end of line";
     }
     else
     {
-        std::cerr << " at '" << token.text << "'";
+        errors << " at '" << token.text << "'";
     }
 
-    std::cerr << ": " << message << std::endl;
+    errors << ": " << message << std::endl;
     hadError = true;
 }
 
@@ -97,6 +98,12 @@ void Parser::consume(enum TokenType type, const std::string& message)
 
 bool Parser::compile()
 {
+    if (ChunkedParser(source, instructions).compile())
+    {
+        end();
+        return true;
+    }
+
     while (!match(TokenType::_EOF))
     {
         line();
@@ -110,57 +117,54 @@ void Parser::line()
 {
     if (match(TokenType::IDENTIFIER))
     {
-        auto name = std::string(previous.text);
-        auto capsName = std::string(previous.text);
-        std::transform(capsName.begin(), capsName.end(), capsName.begin(), ::toupper);
-
-        auto hasBeenDeleted = std::find(deleted.begin(), deleted.end(), capsName) != deleted.end();
+        auto name = previous.text;
+        auto symbol = instructions.findName(name);
+        auto hasBeenDeleted = symbol != nullptr && symbol->left;
 
         if (match(TokenType::COLON))
         {
-            if (hasBeenDeleted) error(name + " has left the match.");
+            if (hasBeenDeleted) error(std::string(name) + " has left the match.");
             consume(TokenType::SINGLE_SPACE, "Expected '<NAME>: <COMMAND>'.");
 
-            if (name != capsName)
+            if (std::any_of(name.begin(), name.end(), ::islower))
             {
                 error("Name must be in ALL CAPS.");
             }
 
-            auto idx = instructions.findName(capsName);
-            if (!idx.has_value())
+            if (symbol == nullptr)
             {
-                error(name + " has not joined the match.");
+                error(std::string(name) + " has not joined the match.");
             }
             else
             {
-                lastTape = idx.value();
+                auto tape = symbol->slot;
+                lastTape = tape;
                 advance();
                 switch(previous.type)
                 {
                     case TokenType::NO_PROBLEM:
-                        emitBytes(OpCode::DECATPTR, idx.value()); 
+                        emitBytes(OpCode::DECATPTR, tape); 
                         break;
                     case TokenType::DEFENDING:
-                        emitBytes(OpCode::DECPTR, idx.value());
+                        emitBytes(OpCode::DECPTR, tape);
                         break;
                     case TokenType::I_GOT_IT:
-                        emitBytes(OpCode::INCPTR, idx.value());
+                        emitBytes(OpCode::INCPTR, tape);
                         break;
                     case TokenType::NICE_SHOT:
-                        emitBytes(OpCode::INCATPTR, idx.value());
+                        emitBytes(OpCode::INCATPTR, tape);
                         break;
                     case TokenType::CALCULATED:
-                        emitBytes(OpCode::OUTPUT, idx.value());
+                        emitBytes(OpCode::OUTPUT, tape);
                         break;
                     case TokenType::GREAT_PASS:
-                        emitBytes(OpCode::COPY_FROM, idx.value());
+                        emitBytes(OpCode::COPY_FROM, tape);
                         break;
                     case TokenType::TAKE_THE_SHOT:
                     {
-                        auto loopStart = instructions.codeCount();
                         loopLevel++;
                         auto currentLoop = loopLevel;
-                        auto thenJump = emitJump(idx.value());
+                        auto loopStart = emitJump(tape);
                         endLine();
                         while (loopLevel >= currentLoop)
                         {
@@ -171,18 +175,17 @@ void Parser::line()
                             }
                             line();
                         }
-                        if (idx.value() != lastTape)
+                        if (tape != lastTape)
                         {
-                            error("Loop must end with the same player: " + name);
+                            error("Loop must end with the same player: " + std::string(name));
                             return;
                         }
-                        emitLoop(idx.value(), loopStart);
-                        instructions.patchJump(idx.value(), thenJump);
+                        emitLoop(loopStart);
                         if (panicMode) synchronize();
                         return;
                     }
                     case TokenType::INCOMING:
-                        emitBytes(OpCode::INPUT, idx.value());
+                        emitBytes(OpCode::INPUT, tape);
                         break;
                     case TokenType::WHAT_A_SAVE:
                         loopLevel--;
@@ -198,31 +201,33 @@ void Parser::line()
             consume(TokenType::SINGLE_SPACE, "Expected '<Name> <JOINED/LEFT>'");
             if (match(TokenType::JOINED))
             {
-                auto idx = instructions.defineName(std::string(capsName), previous.line);
-                if (!idx.has_value())
+                if (instructions.tapeCount() == MAX_TAPES && symbol == nullptr)
                 {
-                    if (hasBeenDeleted)
-                    {
-                        emitBytes(OpCode::DEFINE_NAME, idx.has_value());
-                    }
-                    else
-                    {
-                        error(name + " has already joined the match.");
-                    }
+                    error("Too many players in the match.");
+                }
+                else if (hasBeenDeleted)
+                {
+                    // Back on their old tape, which Great pass! still
+                    // finds by the same number.
+                    symbol->left = false;
+                    emitBytes(OpCode::DEFINE_NAME, symbol->slot);
+                }
+                else if (!instructions.defineName(name, previous.line).has_value())
+                {
+                    error(std::string(name) + " has already joined the match.");
                 }
             }
             else if (match(TokenType::LEFT))
             {
-                if (hasBeenDeleted) error(name + " has left the match.");
-                auto idx = instructions.findName(capsName);
-                if (idx.has_value())
+                if (hasBeenDeleted) error(std::string(name) + " has left the match.");
+                if (symbol != nullptr)
                 {
-                    deleted.insert(capsName);
-                    emitBytes(OpCode::DELETE_NAME, idx.value());
+                    symbol->left = true;
+                    emitBytes(OpCode::DELETE_NAME, symbol->slot);
                 }
                 else
                 {
-                    error(name + " has not joined the match.");
+                    error(std::string(name) + " has not joined the match.");
                 }
             }
             else
@@ -248,24 +253,14 @@ void Parser::endLine()
 
 int Parser::emitJump(int tape)
 {
-    emitByte(OpCode::BEGIN);
-    int thenJump = instructions.codeCount();
-    emitByte(tape);
-    emitByte(0xFF);
-    emitByte(0xFF);
-
-    return thenJump;
+    return instructions.beginLoop(tape, previous.line);
 }
 
-void Parser::emitLoop(int tape, int loopStart)
+// Loops of any length compile; Instructions widens the jumps of those
+// that need it.
+void Parser::emitLoop(int loopStart)
 {
-    emitBytes(OpCode::END, tape);
-
-    int offset = instructions.codeCount() - loopStart + 2;
-    if (offset > UINT16_MAX) error("Loop body too large.");
-
-    emitByte((offset >> 8) & 0xFF);
-    emitByte(offset & 0xFF);
+    instructions.endLoop(loopStart, previous.line);
 }
 
 void Parser::end()
@@ -306,7 +301,7 @@ void Parser::emitBytes(uint8_t byte1, uint8_t byte2)
     emitByte(byte1); emitByte(byte2);
 }
 
-void Parser::emitBytes(OpCode opcode, uint8_t byte)
+void Parser::emitBytes(OpCode opcode, int tape)
 {
-    emitByte(opcode); emitByte(byte);
+    instructions.write(opcode, tape, previous.line);
 }
@@ -3,17 +3,19 @@
 #include "instruction.hpp"
 #include "lexer.hpp"
 #include <cstdint>
-#include <unordered_set>
+#include <iostream>
 
 class Parser
 {
 private:
+    std::string_view source;
     Token current;
     Token previous;
     Lexer lexer;
     Instructions& instructions;
+    std::ostream& errors;
     int loopLevel;
-    std::unordered_set<std::string> deleted;
+    int lastTape;
 
     void advance();
     void consume(enum TokenType type, const std::string& message);
@@ -21,9 +23,9 @@ private:
     void emitByte(uint8_t byte);
     void emitByte(OpCode opcode);
     void emitBytes(uint8_t byte1, uint8_t byte2);
-    void emitBytes(OpCode opcode, uint8_t byte);
+    void emitBytes(OpCode opcode, int tape);
     int emitJump(int tape);
-    void emitLoop(int tape, int loopStart);
+    void emitLoop(int loopStart);
     
     bool match(enum TokenType type);
 
@@ -40,6 +42,6 @@ private:
     void errorAtCurrent(const std::string& message);
     void error(const std::string& message);
 public:
-    Parser(const std::string& source, Instructions& instructions);
+    Parser(std::string_view source, Instructions& instructions, std::ostream& errors = std::cerr);
     bool compile();
 };
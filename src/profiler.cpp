@@ -0,0 +1,193 @@
+#include "profiler.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+
+Profiler::Profiler(const Instructions& instructions, const std::vector<DecodedInstruction>& program, const ProfileCounters& counters)
+    : instructions(instructions), program(program), counters(counters), total(0),
+    tapes(std::vector<TapeTraffic>(instructions.tapeCount(), TapeTraffic()))
+{
+    for (auto hits : counters.hits)
+    {
+        total += hits;
+    }
+
+    countLines();
+    countLoops();
+    countTraffic();
+}
+
+// Hottest first, ties in source order.
+void Profiler::countLines()
+{
+    std::map<int, uint64_t> perLine;
+    for (size_t i = 0; i < program.size() && i < counters.hits.size(); i++)
+    {
+        if (program[i].opcode == OpCode::HALT || counters.hits[i] == 0) continue;
+        perLine[instructions.getLineAt(program[i].source)] += counters.hits[i];
+    }
+
+    lines.assign(perLine.begin(), perLine.end());
+    std::stable_sort(lines.begin(), lines.end(), [](auto& a, auto& b) { return a.second > b.second; });
+}
+
+// END jumps back into its body, so each pair is found from the END side.
+void Profiler::countLoops()
+{
+    for (size_t i = 0; i < program.size() && i < counters.hits.size(); i++)
+    {
+        if (program[i].opcode != OpCode::END || program[i].jump == 0) continue;
+
+        auto begin = program[i].jump - 1;
+        if (program[begin].opcode != OpCode::BEGIN) continue;
+
+        auto loop = LoopProfile();
+        loop.line = instructions.getLineAt(program[begin].source);
+        loop.endLine = instructions.getLineAt(program[i].source);
+        loop.entries = counters.hits[begin];
+        loop.iterations = counters.hits[i];
+        loops.push_back(loop);
+    }
+
+    std::stable_sort(loops.begin(), loops.end(), [](auto& a, auto& b) { return a.iterations > b.iterations; });
+}
+
+// Reads are cells inspected, writes cells changed, moves cells the pointer
+// crossed. MUL_ADD counts a write even when the cell it multiplies is zero
+// and nothing is added.
+void Profiler::countTraffic()
+{
+    for (size_t i = 0; i < program.size() && i < counters.scanned.size(); i++)
+    {
+        auto& instruction = program[i];
+        auto hits = counters.hits[i];
+        if (hits == 0 || instruction.tape >= tapes.size()) continue;
+        auto& tape = tapes[instruction.tape];
+
+        switch (instruction.opcode)
+        {
+            case OpCode::INCPTR:
+            case OpCode::DECPTR:
+            case OpCode::INCPTR_UNCHECKED:
+            case OpCode::DECPTR_UNCHECKED:
+                tape.moves += hits;
+                break;
+            case OpCode::MOVE:
+            case OpCode::MOVE_UNCHECKED:
+                tape.moves += hits * std::abs(instruction.operand);
+                break;
+            case OpCode::SCAN:
+                // One test per cell landed on, plus the one it starts on.
+                tape.reads += hits + counters.scanned[i] / std::abs(instruction.operand);
+                tape.moves += counters.scanned[i];
+                break;
+            case OpCode::INCATPTR:
+            case OpCode::DECATPTR:
+            case OpCode::ADD:
+            case OpCode::SET_ZERO:
+            case OpCode::INPUT:
+                tape.writes += hits;
+                break;
+            case OpCode::OUTPUT:
+            case OpCode::BEGIN:
+            case OpCode::END:
+                tape.reads += hits;
+                break;
+            case OpCode::COPY_FROM:
+            case OpCode::COPY_FROM_UNCHECKED:
+                tape.reads += hits;
+                tape.writes += hits;
+                break;
+            case OpCode::MUL_ADD:
+            case OpCode::MUL_ADD_UNCHECKED:
+                tape.reads += hits;
+                if (instruction.other < tapes.size()) tapes[instruction.other].writes += hits;
+                break;
+            default:
+                break;
+        }
+    }
+
+    for (size_t slot = 0; slot < tapes.size() && slot < counters.copiedFrom.size(); slot++)
+    {
+        tapes[slot].reads += counters.copiedFrom[slot];
+    }
+}
+
+void Profiler::report(std::ostream& out, size_t top) const
+{
+    char buffer[256];
+    auto print = [&](const char* format, auto... args)
+    {
+        snprintf(buffer, sizeof(buffer), format, args...);
+        out << buffer;
+    };
+
+    print("== profile: %llu instructions executed ==\n", static_cast<unsigned long long>(total));
+
+    out << "hot lines:\n";
+    print("  %8s %14s %7s\n", "line", "count", "share");
+    for (size_t i = 0; i < lines.size() && i < top; i++)
+    {
+        print("  %8d %14llu %6.2f%%\n", lines[i].first, static_cast<unsigned long long>(lines[i].second),
+            total == 0 ? 0.0 : 100.0 * lines[i].second / total);
+    }
+
+    out << "loops:\n";
+    print("  %8s %8s %14s %14s %12s\n", "line", "end", "entries", "iterations", "trips/entry");
+    for (size_t i = 0; i < loops.size() && i < top; i++)
+    {
+        auto& loop = loops[i];
+        print("  %8d %8d %14llu %14llu %12.1f\n", loop.line, loop.endLine,
+            static_cast<unsigned long long>(loop.entries), static_cast<unsigned long long>(loop.iterations),
+            loop.entries == 0 ? 0.0 : static_cast<double>(loop.iterations) / loop.entries);
+    }
+
+    out << "tapes:\n";
+    print("  %-16s %14s %14s %14s\n", "name", "reads", "writes", "moves");
+    for (size_t slot = 0; slot < tapes.size(); slot++)
+    {
+        auto& tape = tapes[slot];
+        print("  %-16s %14llu %14llu %14llu\n", instructions.getNameAt(slot).c_str(),
+            static_cast<unsigned long long>(tape.reads), static_cast<unsigned long long>(tape.writes),
+            static_cast<unsigned long long>(tape.moves));
+    }
+}
+
+static std::string jsonString(const std::string& text)
+{
+    std::string result = "\"";
+    for (auto c : text)
+    {
+        if (c == '"' || c == '\\') result += '\\';
+        result += c;
+    }
+    return result + "\"";
+}
+
+void Profiler::writeJson(std::ostream& out) const
+{
+    out << "{\n  \"instructions\": " << total << ",\n  \"lines\": [";
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        out << (i == 0 ? "\n" : ",\n") << "    { \"line\": " << lines[i].first << ", \"count\": " << lines[i].second << " }";
+    }
+
+    out << "\n  ],\n  \"loops\": [";
+    for (size_t i = 0; i < loops.size(); i++)
+    {
+        auto& loop = loops[i];
+        out << (i == 0 ? "\n" : ",\n") << "    { \"line\": " << loop.line << ", \"end\": " << loop.endLine
+            << ", \"entries\": " << loop.entries << ", \"iterations\": " << loop.iterations << " }";
+    }
+
+    out << "\n  ],\n  \"tapes\": [";
+    for (size_t slot = 0; slot < tapes.size(); slot++)
+    {
+        auto& tape = tapes[slot];
+        out << (slot == 0 ? "\n" : ",\n") << "    { \"name\": " << jsonString(instructions.getNameAt(slot))
+            << ", \"reads\": " << tape.reads << ", \"writes\": " << tape.writes << ", \"moves\": " << tape.moves << " }";
+    }
+    out << "\n  ]\n}\n";
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "instruction.hpp"
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Rows per section in the text report; the JSON has every one.
+const size_t PROFILE_REPORT_LINES = 20;
+
+// What the profiling instance of the dispatch loop collects. Everything
+// else in the report is worked out afterwards from these and the program.
+struct ProfileCounters
+{
+    std::vector<uint64_t> hits;         // Per decoded instruction.
+    std::vector<uint64_t> scanned;      // Cells moved by each SCAN, likewise.
+    std::vector<uint64_t> copiedFrom;   // Cells Great pass! read, per source tape.
+};
+
+struct TapeTraffic
+{
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t moves;
+};
+
+struct LoopProfile
+{
+    int line;
+    int endLine;
+    uint64_t entries;       // Times BEGIN ran.
+    uint64_t iterations;    // Times END ran, i.e. trips through the body.
+};
+
+// Turns the counters from a profiled run into a hot-line report, loop trip
+// counts and per-tape traffic. Instructions the optimizer folded count
+// towards the first line they came from.
+class Profiler
+{
+private:
+    const Instructions& instructions;
+    const std::vector<DecodedInstruction>& program;
+    const ProfileCounters& counters;
+
+    uint64_t total;
+    std::vector<std::pair<int, uint64_t>> lines;
+    std::vector<LoopProfile> loops;
+    std::vector<TapeTraffic> tapes;
+
+    void countLines();
+    void countLoops();
+    void countTraffic();
+public:
+    Profiler(const Instructions& instructions, const std::vector<DecodedInstruction>& program, const ProfileCounters& counters);
+
+    void report(std::ostream& out, size_t top) const;
+    void writeJson(std::ostream& out) const;
+};
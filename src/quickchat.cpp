@@ -0,0 +1,214 @@
+#include "quickchat.hpp"
+#include "instruction.hpp"
+#include "vm.hpp"
+#include <sstream>
+#include <streambuf>
+
+struct ProgramData
+{
+    Instructions instructions;
+    std::vector<DecodedInstruction> program;
+    std::string errors;
+    bool valid;
+};
+
+// The VM writes whole blocks, so there's nothing to gain from buffering
+// again in here.
+class CallbackOutput : public std::streambuf
+{
+private:
+    Execution::OutputCallback callback;
+protected:
+    int overflow(int c) override
+    {
+        if (c != traits_type::eof())
+        {
+            char byte = c;
+            callback(&byte, 1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* bytes, std::streamsize size) override
+    {
+        callback(bytes, size);
+        return size;
+    }
+public:
+    CallbackOutput(Execution::OutputCallback callback): callback(std::move(callback)) {};
+};
+
+class CallbackInput : public std::streambuf
+{
+private:
+    Execution::InputCallback callback;
+    char buffer[INPUT_BUFFER_SIZE];
+protected:
+    int underflow() override
+    {
+        auto size = callback(buffer, sizeof(buffer));
+        if (size == 0) return traits_type::eof();
+
+        setg(buffer, buffer, buffer + size);
+        return traits_type::to_int_type(buffer[0]);
+    }
+public:
+    CallbackInput(Execution::InputCallback callback): callback(std::move(callback)) {};
+};
+
+struct ExecutionData
+{
+    std::shared_ptr<const ProgramData> program;
+    VM vm;
+    std::ostringstream output;
+    std::ostringstream errors;
+    std::unique_ptr<std::streambuf> sink;
+    std::unique_ptr<std::streambuf> source;
+    std::ostream out;
+    std::istream in;
+    std::string outputText;
+    std::string errorsText;
+    bool ran;
+    bool suspended;
+
+    ExecutionData(std::shared_ptr<const ProgramData> program)
+        : program(program), vm(program->instructions, program->program), out(output.rdbuf()), in(nullptr), ran(false), suspended(false) {};
+};
+
+Program Program::compile(std::string_view source)
+{
+    auto data = std::make_shared<ProgramData>();
+
+    std::ostringstream errors;
+    auto vm = VM(data->instructions);
+    vm.setErrors(errors);
+    data->valid = vm.compile(source);
+    data->errors = errors.str();
+    if (data->valid) data->program = VM::prepare(data->instructions);
+
+    return Program(data);
+}
+
+bool Program::valid() const
+{
+    return data->valid;
+}
+
+const std::string& Program::errors() const
+{
+    return data->errors;
+}
+
+size_t Program::tapeCount() const
+{
+    return data->instructions.tapeCount();
+}
+
+const std::string& Program::tapeName(size_t slot) const
+{
+    return data->instructions.getNameAt(slot);
+}
+
+size_t Program::codeSize() const
+{
+    return data->instructions.codeCount();
+}
+
+Execution::Execution(const Program& program)
+    : data(std::make_unique<ExecutionData>(program.data))
+{
+    data->vm.setOutput(data->out);
+    data->vm.setErrors(data->errors);
+    data->vm.setInput(nullptr);
+}
+
+Execution::~Execution() = default;
+Execution::Execution(Execution&& other) noexcept = default;
+Execution& Execution::operator=(Execution&& other) noexcept = default;
+
+void Execution::setTapeLimit(size_t cells)
+{
+    data->vm.setTapeLimit(cells);
+}
+
+void Execution::setJit(bool enabled)
+{
+    data->vm.setJit(enabled);
+}
+
+void Execution::setFuel(uint64_t instructions)
+{
+    data->vm.setFuel(instructions);
+}
+
+void Execution::setTimeLimit(std::chrono::milliseconds limit)
+{
+    data->vm.setTimeLimit(limit);
+}
+
+void Execution::setResumable(bool enabled)
+{
+    data->vm.setResumable(enabled);
+}
+
+void Execution::setOutput(OutputCallback callback)
+{
+    data->sink = std::make_unique<CallbackOutput>(std::move(callback));
+    data->out.rdbuf(data->sink.get());
+}
+
+void Execution::setInput(InputCallback callback)
+{
+    data->source = std::make_unique<CallbackInput>(std::move(callback));
+    data->in.rdbuf(data->source.get());
+    data->vm.setInput(&data->in);
+}
+
+void Execution::setInput(std::string buffer)
+{
+    auto source = std::make_unique<std::stringbuf>(std::move(buffer), std::ios::in);
+    data->source = std::move(source);
+    data->in.rdbuf(data->source.get());
+    data->vm.setInput(&data->in);
+}
+
+RunResult Execution::run()
+{
+    if (!data->program->valid)
+    {
+        data->errorsText = data->program->errors;
+        return RunResult::COMPILE_ERROR;
+    }
+
+    if (data->ran && !data->suspended)
+    {
+        data->vm.reset();
+        data->output.str("");
+        data->errors.str("");
+    }
+    data->ran = true;
+
+    auto result = data->vm.run();
+    data->suspended = result == InterpretResult::SUSPENDED;
+    data->out.flush();
+    data->outputText = data->output.str();
+    data->errorsText = data->errors.str();
+
+    switch (result)
+    {
+        case InterpretResult::OK: return RunResult::OK;
+        case InterpretResult::LIMIT_REACHED: return RunResult::LIMIT_REACHED;
+        case InterpretResult::SUSPENDED: return RunResult::SUSPENDED;
+        default: return RunResult::RUNTIME_ERROR;
+    }
+}
+
+const std::string& Execution::output() const
+{
+    return data->outputText;
+}
+
+const std::string& Execution::errors() const
+{
+    return data->errorsText;
+}
@@ -0,0 +1,101 @@
+#include "symbol_table.hpp"
+
+static char upper(char c)
+{
+    return c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c;
+}
+
+// FNV-1a over the upper case spelling.
+uint32_t SymbolTable::hashOf(std::string_view name)
+{
+    uint32_t hash = 2166136261u;
+    for (auto c : name)
+    {
+        hash ^= static_cast<uint8_t>(upper(c));
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool SymbolTable::matches(const std::string& interned, std::string_view name) const
+{
+    if (interned.size() != name.size()) return false;
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        if (interned[i] != upper(name[i])) return false;
+    }
+    return true;
+}
+
+// The entry holding 'name', or the empty one it would go in.
+SymbolTable::Entry& SymbolTable::place(uint32_t hash, std::string_view name)
+{
+    auto mask = entries.size() - 1;
+    for (auto i = hash & mask; ; i = (i + 1) & mask)
+    {
+        auto& entry = entries[i];
+        if (entry.symbol.slot < 0) return entry;
+        if (entry.hash == hash && matches(names[entry.symbol.slot], name)) return entry;
+    }
+}
+
+void SymbolTable::rehash(size_t capacity)
+{
+    auto old = std::move(entries);
+    entries.assign(capacity, { 0, { -1, false } });
+    auto mask = capacity - 1;
+    for (auto& entry : old)
+    {
+        if (entry.symbol.slot < 0) continue;
+        auto i = entry.hash & mask;
+        while (entries[i].symbol.slot >= 0) i = (i + 1) & mask;
+        entries[i] = entry;
+    }
+}
+
+Symbol* SymbolTable::find(std::string_view name)
+{
+    if (entries.empty()) return nullptr;
+    auto& entry = place(hashOf(name), name);
+    return entry.symbol.slot < 0 ? nullptr : &entry.symbol;
+}
+
+const Symbol* SymbolTable::find(std::string_view name) const
+{
+    return const_cast<SymbolTable*>(this)->find(name);
+}
+
+int SymbolTable::define(std::string_view name)
+{
+    if ((names.size() + 1) * 2 > entries.size()) rehash(entries.empty() ? 16 : entries.size() * 2);
+
+    auto& interned = names.emplace_back(name);
+    for (auto& c : interned)
+    {
+        c = upper(c);
+    }
+
+    auto slot = static_cast<int>(names.size()) - 1;
+    auto hash = hashOf(name);
+    place(hash, name) = { hash, { slot, false } };
+    return slot;
+}
+
+// Forgets every name from slot 'count' on, as if they had never joined.
+void SymbolTable::truncate(int count)
+{
+    if (count >= size()) return;
+    names.resize(count);
+    for (auto& entry : entries)
+    {
+        if (entry.symbol.slot >= count) entry = { 0, { -1, false } };
+    }
+    // Emptying entries can break the probe runs of the ones after them.
+    rehash(entries.size());
+}
+
+void SymbolTable::clear()
+{
+    names.clear();
+    entries.clear();
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// What the parsers know about one player: its tape, and whether it has
+// left the match since joining.
+struct Symbol
+{
+    int slot;
+    bool left;
+};
+
+// Tape names, each interned once in upper case and hashed as it would be
+// spelled in upper case, so a name in any spelling finds its symbol in one
+// probe without building a string. Open addressing with linear probing;
+// the table is kept at most half full.
+class SymbolTable
+{
+private:
+    struct Entry
+    {
+        uint32_t hash;
+        Symbol symbol;      // slot is -1 for an empty entry.
+    };
+
+    std::vector<std::string> names;
+    std::vector<Entry> entries;
+
+    static uint32_t hashOf(std::string_view name);
+    bool matches(const std::string& interned, std::string_view name) const;
+    Entry& place(uint32_t hash, std::string_view name);
+    void rehash(size_t capacity);
+public:
+    // Null if no such name was ever defined. Only good until the next
+    // define().
+    Symbol* find(std::string_view name);
+    const Symbol* find(std::string_view name) const;
+
+    // Interns a name find() doesn't know yet, giving it the next slot.
+    int define(std::string_view name);
+
+    const std::string& nameAt(int slot) const { return names[slot]; };
+    int size() const { return names.size(); };
+
+    void truncate(int count);
+    void clear();
+};
@@ -0,0 +1,46 @@
+#include "tape_kernels.hpp"
+#include "tape_kernels_impl.hpp"
+
+#ifdef QUICKCHAT_TAPE_SIMD
+#include <emmintrin.h>
+#endif
+
+static const TapeKernels SCALAR_KERNELS = { "scalar", scanRightLoop, scanLeftLoop };
+
+#ifdef QUICKCHAT_TAPE_SIMD
+// Every x86-64 CPU has SSE2.
+struct Sse2Lanes
+{
+    static const size_t WIDTH = 16;
+
+    static uint32_t zeros(const char* at)
+    {
+        auto cells = _mm_loadu_si128(reinterpret_cast<const __m128i*>(at));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(cells, _mm_setzero_si128())));
+    }
+};
+
+static const TapeKernels SSE2_KERNELS = { "sse2", scanRightBlocks<Sse2Lanes>, scanLeftBlocks<Sse2Lanes> };
+#endif
+
+#ifdef QUICKCHAT_TAPE_AVX2
+extern const TapeKernels AVX2_KERNELS;
+#endif
+
+std::vector<const TapeKernels*> supportedTapeKernels()
+{
+    std::vector<const TapeKernels*> kernels = { &SCALAR_KERNELS };
+#ifdef QUICKCHAT_TAPE_SIMD
+    kernels.push_back(&SSE2_KERNELS);
+#ifdef QUICKCHAT_TAPE_AVX2
+    if (__builtin_cpu_supports("avx2")) kernels.push_back(&AVX2_KERNELS);
+#endif
+#endif
+    return kernels;
+}
+
+const TapeKernels& tapeKernels()
+{
+    static const TapeKernels& best = *supportedTapeKernels().back();
+    return best;
+}
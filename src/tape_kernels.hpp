@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Cells right() and left() look at before calling a kernel.
+const int SHORT_SCAN = 4;
+
+// The loops SCAN runs over a tape's cells, in a version for each
+// instruction set the build knows. tapeKernels() picks the best one the
+// CPU has the first time it is called.
+struct TapeKernels
+{
+    const char* name;
+
+    // The first of from, from + stride, ... that is zero, taking every
+    // cell from 'size' on as zero.
+    size_t (*scanRight)(const char* values, size_t from, size_t size, size_t stride);
+
+    // The first of from, from - stride, ... that is zero, in 'found'. False
+    // if the scan would have to go below cell 0 first.
+    bool (*scanLeft)(const char* values, size_t from, size_t stride, size_t& found);
+
+    // The same, but most scans are over within a few cells, too soon for
+    // a block to pay for setting up, so those few are looked at inline.
+    size_t right(const char* values, size_t from, size_t size, size_t stride) const
+    {
+        for (int i = 0; i < SHORT_SCAN; i++)
+        {
+            if (from >= size || values[from] == 0) return from;
+            from += stride;
+        }
+        return scanRight(values, from, size, stride);
+    }
+
+    bool left(const char* values, size_t from, size_t stride, size_t& found) const
+    {
+        for (int i = 0; i < SHORT_SCAN; i++)
+        {
+            if (values[from] == 0)
+            {
+                found = from;
+                return true;
+            }
+            if (from < stride) return false;
+            from -= stride;
+        }
+        return scanLeft(values, from, stride, found);
+    }
+};
+
+const TapeKernels& tapeKernels();
+
+// Every version this build has that the CPU can run, plain loops first.
+std::vector<const TapeKernels*> supportedTapeKernels();
@@ -0,0 +1,22 @@
+// Built with AVX2 enabled (see CMakeLists.txt), and only ever called once
+// tapeKernels() has seen that the CPU has it.
+
+#include "tape_kernels.hpp"
+#include "tape_kernels_impl.hpp"
+
+#if defined(QUICKCHAT_TAPE_SIMD) && defined(QUICKCHAT_TAPE_AVX2)
+#include <immintrin.h>
+
+struct Avx2Lanes
+{
+    static const size_t WIDTH = 32;
+
+    static uint32_t zeros(const char* at)
+    {
+        auto cells = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(at));
+        return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(cells, _mm256_setzero_si256())));
+    }
+};
+
+extern const TapeKernels AVX2_KERNELS = { "avx2", scanRightBlocks<Avx2Lanes>, scanLeftBlocks<Avx2Lanes> };
+#endif
@@ -0,0 +1,93 @@
+#pragma once
+
+// Shared by the translation units that build each version of the tape
+// kernels. Everything here is static, so a unit built for AVX2 never
+// lends its copy to one that must run without it.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define QUICKCHAT_TAPE_SIMD
+#endif
+
+// What SCAN always did, one cell at a time, apart from the plain walk
+// right which memchr already does a block at a time.
+static size_t scanRightLoop(const char* values, size_t from, size_t size, size_t stride)
+{
+    if (stride == 1)
+    {
+        auto found = memchr(values + from, 0, size - from);
+        return found != nullptr ? static_cast<const char*>(found) - values : size;
+    }
+    while (from < size && values[from] != 0) from += stride;
+    return from;
+}
+
+static bool scanLeftLoop(const char* values, size_t from, size_t stride, size_t& found)
+{
+    while (values[from] != 0)
+    {
+        if (from < stride) return false;
+        from -= stride;
+    }
+    found = from;
+    return true;
+}
+
+#ifdef QUICKCHAT_TAPE_SIMD
+
+// Bits phase, phase + stride, ... of a block of 'width' cells.
+static uint32_t strideLanes(size_t stride, size_t phase, size_t width)
+{
+    uint64_t lanes = 1;
+    for (size_t shift = stride; shift < 32; shift *= 2) lanes |= lanes << shift;
+    lanes <<= phase;
+    return static_cast<uint32_t>(lanes & ((static_cast<uint64_t>(1) << width) - 1));
+}
+
+// Lanes::WIDTH cells at a time, Lanes::zeros(at) having bit i set when
+// at[i] is zero. Every block starts (or, going left, ends) at the next
+// cell the scan looks at, so the cells it looks at are always the same
+// bits of the block. Strides too wide for a block to hold two of those
+// cells, and whatever is left over at the ends of the tape, take the
+// plain loops.
+template <typename Lanes>
+static size_t scanRightBlocks(const char* values, size_t from, size_t size, size_t stride)
+{
+    if (stride == 1 || stride > Lanes::WIDTH / 2 || from >= size) return scanRightLoop(values, from, size, stride);
+
+    auto lanes = strideLanes(stride, 0, Lanes::WIDTH);
+    auto advance = Lanes::WIDTH / stride * stride;
+    while (size - from >= Lanes::WIDTH)
+    {
+        auto hits = Lanes::zeros(values + from) & lanes;
+        if (hits != 0) return from + __builtin_ctz(hits);
+        from += advance;
+    }
+    return scanRightLoop(values, from, size, stride);
+}
+
+template <typename Lanes>
+static bool scanLeftBlocks(const char* values, size_t from, size_t stride, size_t& found)
+{
+    if (stride > Lanes::WIDTH / 2) return scanLeftLoop(values, from, stride, found);
+
+    const size_t last = Lanes::WIDTH - 1;
+    auto lanes = strideLanes(stride, last % stride, Lanes::WIDTH);
+    auto advance = Lanes::WIDTH / stride * stride;
+    while (from >= Lanes::WIDTH)
+    {
+        auto hits = Lanes::zeros(values + from - last) & lanes;
+        if (hits != 0)
+        {
+            found = from - last + (31 - __builtin_clz(hits));
+            return true;
+        }
+        from -= advance;
+    }
+    return scanLeftLoop(values, from, stride, found);
+}
+
+#endif
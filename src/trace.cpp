@@ -0,0 +1,284 @@
+#include "trace.hpp"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+static const char MAGIC[4] = { 'Q', 'C', 'T', '\0' };
+static const size_t HEADER_SIZE = 20;
+
+// Hard to reach honestly, and keeps a damaged trace from asking for
+// terabytes of cells.
+static const size_t MAX_REPLAY_CELLS = static_cast<size_t>(1) << 32;
+
+static void putWord(std::string& out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+
+static uint32_t getWord(const uint8_t* data)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) value |= static_cast<uint32_t>(data[i]) << (8 * i);
+    return value;
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// The header and program are written straight away, before the VM can
+// change the program by running more of it.
+bool TraceWriter::open(const std::string& path, const Instructions& instructions, int cellBits)
+{
+    std::string program;
+    instructions.serialize(program);
+
+    std::string header(MAGIC, sizeof(MAGIC));
+    putWord(header, TRACE_VERSION);
+    putWord(header, BYTECODE_VERSION);
+    putWord(header, cellBits);
+    putWord(header, program.size());
+
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr) return false;
+    if (fwrite(header.data(), 1, header.size(), file) != header.size()
+        || fwrite(program.data(), 1, program.size(), file) != program.size())
+    {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+
+    for (size_t i = 0; i < BUFFER_COUNT; i++)
+    {
+        buffers.push_back(std::make_unique<uint8_t[]>(BUFFER_SIZE));
+        if (i > 0) empty.push_back(buffers[i].get());
+    }
+    buffer = buffers[0].get();
+    cursor = buffer;
+    limit = buffer + BUFFER_SIZE;
+    writer = std::thread(&TraceWriter::work, this);
+    return true;
+}
+
+// Queues the current buffer for writing and carries on in an empty one,
+// waiting for the writer to free one up if they are all queued.
+void TraceWriter::handOff()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    full.push_back({ buffer, static_cast<size_t>(cursor - buffer) });
+    changed.notify_all();
+    changed.wait(guard, [this] { return !empty.empty(); });
+
+    buffer = empty.back();
+    empty.pop_back();
+    cursor = buffer;
+    limit = buffer + BUFFER_SIZE;
+}
+
+void TraceWriter::work()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;)
+    {
+        changed.wait(guard, [this] { return !full.empty() || finished; });
+        if (full.empty()) return;
+
+        auto next = full.front();
+        full.pop_front();
+        guard.unlock();
+        auto written = fwrite(next.first, 1, next.second, file) == next.second;
+        guard.lock();
+
+        if (!written) failed = true;
+        empty.push_back(next.first);
+        changed.notify_all();
+    }
+}
+
+bool TraceWriter::finish()
+{
+    if (file == nullptr) return !failed;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        full.push_back({ buffer, static_cast<size_t>(cursor - buffer) });
+        finished = true;
+    }
+    changed.notify_all();
+    writer.join();
+
+    if (fclose(file) != 0) failed = true;
+    file = nullptr;
+    return !failed;
+}
+
+bool TraceReplay::open(const std::string& path)
+{
+    if (!file.open(path)) return false;
+
+    auto contents = file.view();
+    auto data = reinterpret_cast<const uint8_t*>(contents.data());
+    if (contents.size() < HEADER_SIZE || memcmp(data, MAGIC, sizeof(MAGIC)) != 0) return false;
+    if (getWord(data + 4) != TRACE_VERSION || getWord(data + 8) != BYTECODE_VERSION) return false;
+
+    auto cellBits = getWord(data + 12);
+    if (cellBits != 8 && cellBits != 16 && cellBits != 32) return false;
+    mask = cellBits == 32 ? UINT32_MAX : (static_cast<uint32_t>(1) << cellBits) - 1;
+
+    size_t programSize = getWord(data + 16);
+    if (contents.size() - HEADER_SIZE < programSize) return false;
+    if (!instructions.deserialize(data + HEADER_SIZE, programSize)) return false;
+
+    // Only the tapes and the size of each change come from the events, so
+    // the plain decoded form is enough to know what every one changed.
+    instructions.decode(0, program);
+    indexAt.assign(instructions.codeCount(), -1);
+    for (size_t i = 0; i < program.size(); i++)
+    {
+        indexAt[program[i].source] = static_cast<int32_t>(i);
+    }
+    tapes.assign(instructions.tapeCount(), { std::vector<uint32_t>(), 0, false });
+
+    next = data + HEADER_SIZE + programSize;
+    end = data + contents.size();
+    return true;
+}
+
+bool TraceReplay::get(uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && next != end; shift += 7)
+    {
+        auto byte = *next++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+uint32_t& TraceReplay::cell(ReplayTape& tape, size_t index)
+{
+    if (index >= tape.cells.size()) tape.cells.resize(index + 1, 0);
+    return tape.cells[index];
+}
+
+// Cells wrap at the width the trace was recorded with.
+void TraceReplay::add(ReplayTape& tape, size_t index, int64_t change)
+{
+    auto& value = cell(tape, index);
+    value = static_cast<uint32_t>(value + change) & mask;
+}
+
+bool TraceReplay::step()
+{
+    if (next == end || malformed) return false;
+
+    uint64_t skip;
+    uint64_t amount;
+    if (!get(skip) || !get(amount))
+    {
+        malformed = true;
+        return false;
+    }
+    offset = static_cast<uint32_t>(offset + unzigzag(skip));
+    if (offset >= indexAt.size() || indexAt[offset] < 0)
+    {
+        malformed = true;
+        return false;
+    }
+
+    auto& instruction = program[indexAt[offset]];
+    auto change = unzigzag(amount);
+    auto& tape = tapes[instruction.tape];
+    switch (instruction.opcode)
+    {
+        case OpCode::INCPTR:
+        case OpCode::DECPTR:
+        case OpCode::MOVE:
+        case OpCode::SCAN:
+            tape.ptr += change;
+            malformed = tape.ptr >= MAX_REPLAY_CELLS;
+            break;
+        case OpCode::DEFINE_NAME:
+        case OpCode::DELETE_NAME:
+            tape.cells.clear();
+            tape.ptr = 0;
+            tape.joined = instruction.opcode == OpCode::DEFINE_NAME;
+            break;
+        case OpCode::MUL_ADD:
+        {
+            auto& to = tapes[instruction.other];
+            malformed = to.ptr + instruction.offset >= MAX_REPLAY_CELLS;
+            if (!malformed) add(to, to.ptr + instruction.offset, change);
+            break;
+        }
+        case OpCode::DECATPTR:
+        case OpCode::INCATPTR:
+        case OpCode::INPUT:
+        case OpCode::COPY_FROM:
+        case OpCode::ADD:
+        case OpCode::SET_ZERO:
+            add(tape, tape.ptr, change);
+            break;
+        default:
+            // Loops and output never change a tape.
+            malformed = true;
+            break;
+    }
+    if (malformed) return false;
+
+    steps++;
+    return true;
+}
+
+void TraceReplay::report() const
+{
+    if (steps == 0)
+    {
+        std::cout << "Before the first step:\n";
+    }
+    else
+    {
+        std::cout << "After step " << steps << ", line " << instructions.getLineAt(offset) << ":\n";
+        instructions.disassembleInstructionAt(offset);
+    }
+
+    size_t width = 0;
+    for (size_t i = 0; i < tapes.size(); i++)
+    {
+        if (tapes[i].joined) width = std::max(width, instructions.getNameAt(i).size());
+    }
+
+    // A window of cells either side of the pointer, with "..." wherever
+    // something that isn't zero is left out.
+    const size_t reach = 8;
+    for (size_t i = 0; i < tapes.size(); i++)
+    {
+        auto& tape = tapes[i];
+        if (!tape.joined) continue;
+
+        auto& name = instructions.getNameAt(i);
+        std::cout << name << std::string(width - name.size(), ' ') << "  pointer " << tape.ptr << ":";
+
+        auto first = tape.ptr > reach ? tape.ptr - reach : 0;
+        auto last = tape.ptr + reach;
+        auto size = tape.cells.size();
+        if (std::any_of(tape.cells.begin(), tape.cells.begin() + std::min(first, size), [](uint32_t c) { return c != 0; }))
+        {
+            std::cout << " ...";
+        }
+        for (auto at = first; at <= last; at++)
+        {
+            uint32_t value = at < size ? tape.cells[at] : 0;
+            if (at == tape.ptr) std::cout << " [" << value << "]";
+            else std::cout << " " << value;
+        }
+        if (last + 1 < size && std::any_of(tape.cells.begin() + last + 1, tape.cells.end(), [](uint32_t c) { return c != 0; }))
+        {
+            std::cout << " ...";
+        }
+        std::cout << "\n";
+    }
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "instruction.hpp"
+#include "mapped_file.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Bumped whenever the layout of a trace file changes.
+const uint32_t TRACE_VERSION = 2;
+
+// A trace is a header (with the cell width), the program as it ran, then
+// one event for every instruction that changed a tape: its offset in the
+// bytecode and by how much it changed what it changes (the cell under the
+// pointer, the cell MUL_ADD adds to, or the pointer). The tape is the
+// instruction's own, so it isn't stored. Both numbers are zigzag varints,
+// the offset taken relative to the event before, so a loop costs about two
+// bytes per step. Joining and leaving are events with no change, since
+// they always start the tape over.
+//
+// Events are put together in memory and written out by a thread of their
+// own, so the VM only waits on the disk if it gets a few buffers ahead.
+class TraceWriter
+{
+private:
+    static const size_t BUFFER_SIZE = 1 << 20;
+    static const size_t BUFFER_COUNT = 4;
+    static const size_t MAX_EVENT_SIZE = 20;
+
+    FILE* file;
+    std::thread writer;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::vector<std::unique_ptr<uint8_t[]>> buffers;
+    std::deque<std::pair<uint8_t*, size_t>> full;       // Oldest first.
+    std::vector<uint8_t*> empty;
+    bool finished;
+    bool failed;
+
+    uint8_t* buffer;
+    uint8_t* cursor;
+    uint8_t* limit;
+    uint32_t last;
+
+    static uint8_t* put(uint8_t* at, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            *at++ = static_cast<uint8_t>(value | 0x80);
+            value >>= 7;
+        }
+        *at++ = static_cast<uint8_t>(value);
+        return at;
+    };
+    static uint64_t zigzag(int64_t value) { return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63); };
+
+    void handOff();
+    void work();
+public:
+    TraceWriter(): file(nullptr), finished(false), failed(false), buffer(nullptr), cursor(nullptr), limit(nullptr), last(0) {};
+    ~TraceWriter() { finish(); };
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    bool open(const std::string& path, const Instructions& instructions, int cellBits);
+
+    void record(uint32_t source, int64_t change)
+    {
+        if (static_cast<size_t>(limit - cursor) < MAX_EVENT_SIZE) handOff();
+        cursor = put(cursor, zigzag(static_cast<int64_t>(source) - last));
+        cursor = put(cursor, zigzag(change));
+        last = source;
+    };
+
+    // Writes out what is left and waits for the writer. False if anything
+    // failed to reach the file.
+    bool finish();
+};
+
+// Plays a trace back over tapes of its own, one event (step) at a time,
+// to show what they held at any step of the run.
+class TraceReplay
+{
+private:
+    struct ReplayTape
+    {
+        std::vector<uint32_t> cells;
+        size_t ptr;
+        bool joined;
+    };
+
+    MappedFile file;
+    Instructions instructions;
+    std::vector<DecodedInstruction> program;
+    std::vector<int32_t> indexAt;       // Bytecode offset -> index in program.
+    std::vector<ReplayTape> tapes;
+    uint32_t mask;                      // Of the bits a cell holds.
+    const uint8_t* next;
+    const uint8_t* end;
+    uint32_t offset;
+    uint64_t steps;
+    bool malformed;
+
+    bool get(uint64_t& value);
+    uint32_t& cell(ReplayTape& tape, size_t index);
+    void add(ReplayTape& tape, size_t index, int64_t change);
+public:
+    TraceReplay(): mask(0), next(nullptr), end(nullptr), offset(0), steps(0), malformed(false) {};
+
+    // False if the file can't be read or isn't a trace.
+    bool open(const std::string& path);
+
+    // Applies the next event. False at the end of the trace, or if the
+    // event doesn't fit the program.
+    bool step();
+    uint64_t stepCount() const { return steps; };
+    bool isMalformed() const { return malformed; };
+
+    // Prints the instruction behind the last step and every tape in the
+    // match, the way disassemble() prints, to stdout.
+    void report() const;
+};
@@ -1,27 +1,252 @@
 #include "vm.hpp"
+#include "analyzer.hpp"
 #include "parser.hpp"
 #include "instruction.hpp"
+#include "optimizer.hpp"
+#include "trace.hpp"
+#include <algorithm>
 #include <cstdarg>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <type_traits>
 
-//#define DEBUG_TRACE_EXECUTION
+#ifdef _WIN32
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+
+// Line of an instruction's last byte, which is what the bytecode VM used
+// to report for it.
+int VM::lineOf(const DecodedInstruction& instruction) const
+{
+    return instructions.getLineAt(instruction.source + instructions.getSizeAt(instruction.source) - 1);
+}
+
+void VM::write(char c)
+{
+    if (unbuffered)
+    {
+        out->put(c);
+        out->flush();
+        return;
+    }
+
+    output.push_back(c);
+    if (output.size() >= OUTPUT_BUFFER_SIZE) flush();
+}
+
+void VM::flush()
+{
+    if (output.empty()) return;
+    out->write(output.data(), output.size());
+    out->flush();
+    output.clear();
+}
+
+// Reads the input a block at a time. A terminal gets a byte at a time
+// instead, after flushing output, so prompts show up before the script
+// waits. Without an input stream every read is EOF. Reads go straight to
+// the stream buffer, since std::cin's sentry would flush std::cout on
+// every byte.
+int VM::read()
+{
+    if (in == nullptr) return EOF;
+    auto buffer = in->rdbuf();
+    if (unbuffered) return buffer->sbumpc();
+
+    if (inputPos == input.size())
+    {
+        if (in == &std::cin && isatty(fileno(stdin)))
+        {
+            flush();
+            return buffer->sbumpc();
+        }
+
+        input.resize(INPUT_BUFFER_SIZE);
+        input.resize(buffer->sgetn(input.data(), input.size()));
+        inputPos = 0;
+        if (input.empty()) return EOF;
+    }
+    return static_cast<unsigned char>(input[inputPos++]);
+}
+
+static std::string formatMessage(const char* format, va_list args)
+{
+    va_list copy;
+    va_copy(copy, args);
+    auto size = vsnprintf(nullptr, 0, format, copy);
+    va_end(copy);
+
+    std::string message(std::max(size, 0), '\0');
+    vsnprintf(message.data(), message.size() + 1, format, args);
+    return message;
+}
 
 void VM::runtimeError(const char* format, ...)
 {
+    flush();
+
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    *errors << formatMessage(format, args) << std::endl;
     va_end(args);
-    std::cerr << std::endl;
     
-    std::cerr << "[line " << instructions.getLineAt(ip - 1) << "] in script" << std::endl;
+    *errors << "[line " << lineOf((*program)[ip - 1]) << "] in script" << std::endl;
+}
+
+void VM::runtimeErrorAt(int line, const char* format, ...)
+{
+    flush();
+
+    va_list args;
+    va_start(args, format);
+    *errors << formatMessage(format, args) << std::endl;
+    va_end(args);
+
+    *errors << "[line " << line << "] in script" << std::endl;
+}
+
+// Reports a folded run of 'count' moves (a MOVE or SCAN) where the move
+// after the first 'moves' would leave the tape. The run stepped through its
+// source lines evenly, so the line of the move that failed can be worked
+// out from the lines of the instruction's first and last bytes.
+void VM::moveError(int slot, size_t moves, int count, bool right)
+{
+    int first = instructions.getLineAt((*program)[ip - 1].source);
+    int last = lineOf((*program)[ip - 1]);
+    int step = count == 1 ? 0 : (last - first) / (count - 1);
+    std::string error = right
+        ? "Attempting to increment the pointer past the end of " + instructions.getNameAt(slot) + "."
+        : "Attempting to decrement the pointer below 0 on " + instructions.getNameAt(slot) + ".";
+    runtimeErrorAt(first + static_cast<int>(moves) * step, error.c_str());
+}
+
+// Retraces a SCAN that scan() refused, to find the move that fails, and
+// leaves the pointer where the old one-move-at-a-time loop stopped.
+void VM::scanError(int slot, int stride)
+{
+    auto& tape = tapes[slot];
+    auto ptr = tape.ptr;
+    if (stride < 0)
+    {
+        while (ptr >= static_cast<size_t>(-stride)) ptr += stride;
+        moveError(slot, ptr, -stride, false);
+        tape.ptr = 0;
+    }
+    else
+    {
+        while (ptr + stride < tapeLimit) ptr += stride;
+        moveError(slot, tapeLimit - 1 - ptr, stride, true);
+        tape.ptr = tapeLimit - 1;
+    }
+}
+
+// Grows the tape so 'index' can be addressed, at least doubling each time
+// to keep long walks cheap. False if 'index' is past 'limit'. The cells it
+// moves out of stay with the arena until it is reset.
+bool Tape::reach(size_t index, size_t limit)
+{
+    if (index >= limit) return false;
+    if (index < size) return true;
+
+    auto grown = std::min(std::max(index + 1, size * 2), limit);
+    auto cells = arena->allocate(grown);
+    memcpy(cells, values, size * arena->cellSize());
+    values = cells;
+    size = grown;
+    return true;
+}
+
+// Starts the tape over with at least 'cells' cells: the ones it has if
+// there are enough, otherwise ones another tape gave back, or new ones.
+void Tape::join(size_t cells)
+{
+    if (values != parked && size >= cells)
+    {
+        memset(values, 0, size * arena->cellSize());
+    }
+    else
+    {
+        values = arena->acquire(cells);
+        size = cells;
+    }
+    ptr = 0;
+}
+
+// Gives the cells back for whoever joins next and parks the tape.
+void Tape::leave()
+{
+    if (values != parked) arena->release(values, size);
+    values = parked;
+    size = 1;
+    ptr = 0;
+    memset(parked, 0, arena->cellSize());
 }
 
-InterpretResult VM::interpret(const std::string& source)
+// Moves the pointer to the next zero cell 'stride' cells at a time. Cells
+// past the end of the storage are zero, so reaching one ends the scan. On
+// failure the pointer is left alone for scanError() to retrace. The
+// kernels only know bytes, so wider cells take plain loops.
+template <typename Cell>
+bool VM::scan(Tape& tape, int stride)
 {
-    auto parser = Parser(source, instructions);
+    size_t ptr = tape.ptr;
+    if (sizeof(Cell) == 1)
+    {
+        if (stride > 0)
+        {
+            ptr = kernels.right(tape.values, ptr, tape.size, stride);
+        }
+        else if (!kernels.left(tape.values, ptr, -stride, ptr))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        auto cells = tape.cells<Cell>();
+        if (stride > 0)
+        {
+            while (ptr < tape.size && cells[ptr] != 0) ptr += stride;
+        }
+        else
+        {
+            while (cells[ptr] != 0)
+            {
+                if (ptr < static_cast<size_t>(-stride)) return false;
+                ptr += stride;
+            }
+        }
+    }
+
+    if (!tape.reach(ptr, tapeLimit)) return false;
+    tape.ptr = ptr;
+    return true;
+}
+
+// Parses and optimizes 'source' onto the end of the code without running it.
+bool VM::compile(std::string_view source)
+{
+    if (writable == nullptr) return false;
+    auto parser = Parser(source, *writable, *errors);
 
+    auto start = writable->codeCount();
     if (!parser.compile())
+    {
+        return false;
+    }
+
+    Optimizer(*writable, cellBits).optimize(start);
+    return true;
+}
+
+InterpretResult VM::interpret(std::string_view source)
+{
+    if (!compile(source))
     {
         return InterpretResult::COMPILE_ERROR;
     }
@@ -31,123 +256,566 @@ InterpretResult VM::interpret(const std::string& source)
     return result;
 }
 
-InterpretResult VM::run()
+// Drops all the code compiled so far, keeping the tapes and the names.
+// Only safe once what was compiled has run to the end (or failed), since
+// nothing may jump back into it afterwards.
+void VM::discard()
 {
-    auto readByte = [this]() -> uint8_t
+    if (writable == nullptr) return;
+    writable->clear();
+    ownProgram.clear();
+    decoded = 0;
+    ip = 0;
+}
+
+// Puts the program back at the start with blank tapes and no pending
+// input, for running it again. The tapes come out of the same arena, and
+// the decoded program is kept, so once a run has sized them nothing more
+// is allocated.
+void VM::reset()
+{
+    flush();
+    ip = 0;
+    rewound = true;
+    tapes.clear();
+    arena.reset();
+    input.clear();
+    inputPos = 0;
+    std::fill(profile.hits.begin(), profile.hits.end(), 0);
+    std::fill(profile.scanned.begin(), profile.scanned.end(), 0);
+    std::fill(profile.copiedFrom.begin(), profile.copiedFrom.end(), 0);
+}
+
+// A decoded program always ends in a HALT so the dispatch loop never has
+// to check whether it ran off the end.
+static void appendHalt(std::vector<DecodedInstruction>& program, int end)
+{
+    auto halt = DecodedInstruction();
+    halt.opcode = OpCode::HALT;
+    halt.source = end;
+    program.push_back(halt);
+}
+
+// Decodes all of 'instructions' once, for any number of VMs to share.
+std::vector<DecodedInstruction> VM::prepare(const Instructions& instructions)
+{
+    std::vector<DecodedInstruction> program;
+    instructions.decode(0, program);
+
+    // Every run starts with the pointers at 0, but the tape limit isn't
+    // known yet, so nothing past the first cell is taken for granted.
+    auto fresh = PointerRange{ 0, 0, 1 };
+    Analyzer(program, std::vector<PointerRange>(instructions.tapeCount(), fresh), 1, DEFAULT_CELL_BITS).analyze(0);
+    appendHalt(program, instructions.codeCount());
+    return program;
+}
+
+// Appends whatever the parser has written since the last run to the
+// decoded program. It runs next, from the tapes as they are now, so that
+// is where the analysis starts. A shared program is complete already.
+void VM::decode()
+{
+    if (writable == nullptr) return;
+
+    // After reset() the tapes are blank again. A program analyzed in one
+    // go from blank tapes still holds for them, but one built up run by
+    // run assumed whatever the tapes held then, so it starts over.
+    auto blank = rewound;
+    rewound = false;
+    if (blank && (!fromStart || decoded != instructions.codeCount()))
+    {
+        ownProgram.clear();
+        decoded = 0;
+    }
+    if (!ownProgram.empty() && decoded == instructions.codeCount()) return;
+
+    if (!ownProgram.empty()) ownProgram.pop_back();
+    auto start = ownProgram.size();
+    fromStart = blank && start == 0;
+    instructions.decode(decoded, ownProgram);
+    decoded = instructions.codeCount();
+
+    if (analyzing)
+    {
+        std::vector<PointerRange> entry;
+        for (auto& tape : tapes)
+        {
+            entry.push_back({ tape.ptr, tape.ptr, tape.size });
+        }
+        Analyzer(ownProgram, std::move(entry), joinedSize(), cellBits).analyze(start);
+    }
+    appendHalt(ownProgram, decoded);
+}
+
+// Points compiled code's view of a tape at its current storage.
+void VM::mirror(int slot)
+{
+    auto& tape = tapes[slot];
+    auto begin = tape.values;
+    jitTapes[slot] = { begin + tape.ptr, begin, begin + tape.size };
+}
+
+// Runs the decoded program from ip as native code. Returns false if the
+// compiled code stopped before the end, leaving ip on the instruction the
+// interpreter has to take over from (always one that is about to fail).
+bool VM::runCompiled()
+{
+    auto compiled = Jit();
+    if (!compiled.compile(*program, ip, tapes.size())) return false;
+
+    jitTapes.resize(tapes.size());
+    for (size_t i = 0; i < tapes.size(); i++)
+    {
+        mirror(i);
+    }
+
+    // The callbacks that touch a tape first pick up its pointer from
+    // compiled code, and hand the (possibly moved) storage back after.
+    JitContext context;
+    context.host = this;
+    context.output = [](void* host, int value)
+    {
+        static_cast<VM*>(host)->write(static_cast<char>(value));
+    };
+    context.input = [](void* host) -> int
     {
-        return this->instructions.getCodeAt(this->ip++);
+        return static_cast<VM*>(host)->read();
+    };
+    context.reset = [](void* host, int tape, int joining)
+    {
+        auto vm = static_cast<VM*>(host);
+        auto& t = vm->tapes[tape];
+        if (joining) t.join(vm->joinedSize());
+        else t.leave();
+        vm->mirror(tape);
+    };
+    context.reserve = [](void* host, int tape, int cells) -> int
+    {
+        auto vm = static_cast<VM*>(host);
+        auto& t = vm->tapes[tape];
+        t.ptr = vm->jitTapes[tape].cell - vm->jitTapes[tape].begin;
+        if (!t.reach(t.ptr + cells, vm->tapeLimit)) return 1;
+        vm->mirror(tape);
+        return 0;
+    };
+    context.scan = [](void* host, int tape, int stride) -> int
+    {
+        auto vm = static_cast<VM*>(host);
+        auto& t = vm->tapes[tape];
+        t.ptr = vm->jitTapes[tape].cell - vm->jitTapes[tape].begin;
+        if (!vm->scan<uint8_t>(t, stride)) return 1;
+        vm->mirror(tape);
+        return 0;
     };
 
-    while (instructions.hasCodeAt(ip))
+    ip = compiled.run(context, jitTapes.data());
+
+    for (size_t i = 0; i < tapes.size(); i++)
     {
-#ifdef DEBUG_TRACE_EXECUTION
-        instructions.disassembleInstruction(ip);
-#endif
+        tapes[i].ptr = jitTapes[i].cell - jitTapes[i].begin;
+    }
+    return (*program)[ip].opcode == OpCode::HALT;
+}
 
-        auto instruction = OpCode(readByte());
-        switch (instruction)
+InterpretResult VM::run()
+{
+    // Every slot the parser handed out gets a parked tape up front, so the
+    // loop below can index by the operand without any lookups. There is
+    // room reserved for all of them to join at once, but only the cells
+    // of players who join are ever touched.
+    auto tapeCount = static_cast<size_t>(instructions.tapeCount());
+    if (tapes.size() < tapeCount)
+    {
+        arena.reserve(tapeCount * (1 + joinedSize()));
+        while (tapes.size() < tapeCount)
         {
-            case OpCode::BEGIN:
-            {
-                const auto& name = instructions.getNameAt(readByte());
-                auto& tape = tapes.at(name);
-                
-                uint16_t offset = (readByte() << 8) | readByte();
-                if (tape.values[tape.ptr] == 0) ip += offset;
+            tapes.emplace_back(arena);
+        }
+    }
 
-                break;
-            }
-            case OpCode::DECATPTR:
-            {
-                const auto& name = instructions.getNameAt(readByte());
-                auto& tape = tapes.at(name);
-                tape.values[tape.ptr] = tape.values[tape.ptr] - 1;
+    // Unchecked code never grows a tape, so it starts with every one as big
+    // as it may get, and leaving doesn't park them.
+    if (unchecked)
+    {
+        for (auto& tape : tapes)
+        {
+            tape.reach(tapeLimit - 1, tapeLimit);
+        }
+    }
+    decode();
 
-                break;
-            }
-            case OpCode::DECPTR:
+    spent = 0;
+    if (timeLimit.count() != 0) deadline = std::chrono::steady_clock::now() + timeLimit;
+    grant();
+
+    // Compiled code can't count or record what it runs, so profiling,
+    // tracing and limits always interpret.
+    if (profiling)
+    {
+        profile.hits.resize(program->size());
+        profile.scanned.resize(program->size());
+        profile.copiedFrom.resize(tapes.size());
+        return trace != nullptr ? executeCells<RunPolicy<true, true, true, true>>() : executeCells<RunPolicy<true, true, true, false>>();
+    }
+    if (trace != nullptr) return executeCells<RunPolicy<true, true, false, true>>();
+
+    if (jit && cellBits == 8 && !limited())
+    {
+        if (runCompiled())
+        {
+            flush();
+            return InterpretResult::OK;
+        }
+        // Compiled code only stops early at an error, which it leaves
+        // to the checks to report.
+        return execute<uint8_t, RunPolicy<true, false>>();
+    }
+
+    if (unchecked) return limited() ? executeCells<RunPolicy<false, true>>() : executeCells<RunPolicy<false, false>>();
+    return limited() ? executeCells<RunPolicy<true, true>>() : executeCells<RunPolicy<true, false>>();
+}
+
+// The instance of the dispatch loop for the VM's cell width.
+template <typename Policy>
+InterpretResult VM::executeCells()
+{
+    switch (cellBits)
+    {
+        case 16: return execute<uint16_t, Policy>();
+        case 32: return execute<uint32_t, Policy>();
+        default: return execute<uint8_t, Policy>();
+    }
+}
+
+// Sets how many instructions the dispatch loop may run before it next has
+// to call refuel(): the fuel left, but only as far as the next look at the
+// clock.
+void VM::grant()
+{
+    granted = INT64_MAX;
+    if (fuel != 0) granted = static_cast<int64_t>(std::min<uint64_t>(fuel - spent, INT64_MAX));
+    if (timeLimit.count() != 0) granted = std::min(granted, CLOCK_CHECK_INTERVAL);
+}
+
+// The dispatch loop spent all it was granted, and maybe a loop body more.
+// Returns its next budget, or 0 if that used up the fuel or the time.
+int64_t VM::refuel(int64_t budget)
+{
+    spent += granted - budget;
+    if (fuel != 0 && spent >= fuel) return 0;
+    if (timeLimit.count() != 0 && std::chrono::steady_clock::now() >= deadline) return 0;
+
+    grant();
+    return granted;
+}
+
+// A limit ran out at the END at 'end', just as it was about to go round
+// again. Resumable runs stop there to carry on into the body next time;
+// otherwise it is an error, reported at the top of the loop.
+InterpretResult VM::limitReached(unsigned end)
+{
+    auto& instruction = (*program)[end];
+    if (resumable)
+    {
+        ip = instruction.jump;
+        flush();
+        return InterpretResult::SUSPENDED;
+    }
+
+    ip = end + 1;
+    auto line = instructions.getLineAt((*program)[instruction.jump - 1].source);
+    runtimeErrorAt(line, fuel != 0 && spent >= fuel ? "Instruction limit reached." : "Time limit reached.");
+    return InterpretResult::LIMIT_REACHED;
+}
+
+// The dispatch loop proper, for cells of type Cell and whatever Policy
+// asks for on top: the profiling instances also tally every instruction
+// they dispatch and the cells scans and copies touch, the tracing ones
+// record every change to a tape, and the unchecked ones leave out every
+// check but the ones a scan needs to stop. What an instance doesn't ask
+// for is compiled away.
+template <typename Cell, typename Policy>
+InterpretResult VM::execute()
+{
+    using Signed = std::make_signed_t<Cell>;
+    const DecodedInstruction* start = program->data();
+    const DecodedInstruction* pc = start + ip;
+    Tape* tape = tapes.data();
+    uint64_t* hits = profile.hits.data();
+    int64_t budget = granted;
+
+#define VM_STEP() (Policy::profiling ? (void)hits[pc - start]++ : (void)0)
+#define VM_RECORD(change) (Policy::tracing ? trace->record(pc->source, (change)) : (void)0)
+#define VM_CELL(t) (t).template cells<Cell>()[(t).ptr]
+
+#ifdef QUICKCHAT_COMPUTED_GOTO
+    // Must follow the order of OpCode.
+    static void* dispatchTable[] =
+    {
+        &&op_INCPTR, &&op_DECPTR, &&op_INCATPTR, &&op_DECATPTR,
+        &&op_OUTPUT, &&op_INPUT, &&op_BEGIN, &&op_END,
+        &&op_DEFINE_NAME, &&op_DELETE_NAME, &&op_COPY_FROM,
+        &&op_ADD, &&op_MOVE, &&op_SET_ZERO, &&op_MUL_ADD, &&op_SCAN,
+        &&op_HALT,
+        &&op_INCPTR_UNCHECKED, &&op_DECPTR_UNCHECKED, &&op_MOVE_UNCHECKED,
+        &&op_COPY_FROM_UNCHECKED, &&op_MUL_ADD_UNCHECKED,
+    };
+#define VM_DISPATCH() VM_STEP(); goto *dispatchTable[static_cast<uint8_t>(pc->opcode)];
+#define VM_CASE(opcode) op_##opcode:
+#define VM_NEXT() { pc++; VM_STEP(); goto *dispatchTable[static_cast<uint8_t>(pc->opcode)]; }
+#define VM_JUMP(index) { pc = start + (index); VM_STEP(); goto *dispatchTable[static_cast<uint8_t>(pc->opcode)]; }
+#else
+#define VM_DISPATCH() for (;;) switch (VM_STEP(), pc->opcode)
+#define VM_CASE(opcode) case OpCode::opcode:
+#define VM_NEXT() { pc++; continue; }
+#define VM_JUMP(index) { pc = start + (index); continue; }
+#endif
+
+// Leaves ip just past the failing instruction, as runtimeError expects.
+#define VM_ERROR() { ip = static_cast<unsigned>(pc - start) + 1; }
+
+// A cell's change is recorded modulo the cell's width, as the cell
+// itself wraps.
+#define VM_CHANGE(value, old) static_cast<Signed>(static_cast<Cell>((value) - (old)))
+
+    VM_DISPATCH()
+    {
+        VM_CASE(BEGIN)
+        {
+            auto& t = tape[pc->tape];
+            if (VM_CELL(t) == 0) VM_JUMP(pc->jump);
+            VM_NEXT();
+        }
+        VM_CASE(END)
+        {
+            auto& t = tape[pc->tape];
+            if (VM_CELL(t) != 0)
             {
-                const auto& name = instructions.getNameAt(readByte());
-                auto& tape = tapes.at(name);
-                if (tape.ptr == 0)
+                // Charged a body's length per trip; anything nested
+                // charges its own trips.
+                if (Policy::limits)
                 {
-                    std::string error = "Attempting to decrement the pointer below 0 on " + name + ".";
-                    runtimeError(error.c_str());
-                    return InterpretResult::RUNTIME_ERROR;
+                    budget -= pc - start - pc->jump + 1;
+                    if (budget <= 0 && (budget = refuel(budget)) == 0) return limitReached(static_cast<unsigned>(pc - start));
                 }
-                else
-                {
-                    tape.ptr--;
-                }
-                break;
-            }
-            case OpCode::DEFINE_NAME:
-            {
-                const auto& name = instructions.getNameAt(readByte());
-                tapes[name] = Tape();
-                break;
+                VM_JUMP(pc->jump);
             }
-            case OpCode::DELETE_NAME:
-            {
-                // Should actually erase the tape or something here.
-                const auto& name = instructions.getNameAt(readByte());
-                tapes[name] = Tape();
-                break;
-            }
-            case OpCode::END:
+            VM_NEXT();
+        }
+        VM_CASE(DECATPTR)
+        {
+            auto& t = tape[pc->tape];
+            VM_CELL(t) = VM_CELL(t) - 1;
+            VM_RECORD(-1);
+            VM_NEXT();
+        }
+        VM_CASE(DECPTR)
+        {
+            auto& t = tape[pc->tape];
+            if (Policy::checks && t.ptr == 0)
             {
-                readByte(); // Tape name, not required here.
-                uint16_t offset = (readByte() << 8) | readByte();
-                ip -= offset;
-                break;
+                VM_ERROR();
+                std::string error = "Attempting to decrement the pointer below 0 on " + instructions.getNameAt(pc->tape) + ".";
+                runtimeError(error.c_str());
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case OpCode::INCATPTR:
+            t.ptr--;
+            VM_RECORD(-1);
+            VM_NEXT();
+        }
+        VM_CASE(DEFINE_NAME)
+        {
+            tape[pc->tape].join(joinedSize());
+            VM_RECORD(0);
+            VM_NEXT();
+        }
+        VM_CASE(DELETE_NAME)
+        {
+            // Unchecked code can't have a tape shrink under it.
+            if (Policy::checks) tape[pc->tape].leave();
+            else tape[pc->tape].join(joinedSize());
+            VM_RECORD(0);
+            VM_NEXT();
+        }
+        VM_CASE(INCATPTR)
+        {
+            auto& t = tape[pc->tape];
+            VM_CELL(t) = VM_CELL(t) + 1;
+            VM_RECORD(1);
+            VM_NEXT();
+        }
+        VM_CASE(INCPTR)
+        {
+            auto& t = tape[pc->tape];
+            if (Policy::checks && t.ptr + 1 == t.size && !t.reach(t.ptr + 1, tapeLimit))
             {
-                const auto& name = instructions.getNameAt(readByte());
-                auto& tape = tapes.at(name);
-                tape.values[tape.ptr] = tape.values[tape.ptr] + 1;
-
-                break;
+                VM_ERROR();
+                std::string error = "Attempting to increment the pointer past the end of " + instructions.getNameAt(pc->tape) + ".";
+                runtimeError(error.c_str());
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case OpCode::INCPTR:
+            t.ptr++;
+            VM_RECORD(1);
+            VM_NEXT();
+        }
+        VM_CASE(INPUT)
+        {
+            // EOF is all ones, whatever the width.
+            auto& t = tape[pc->tape];
+            auto old = VM_CELL(t);
+            VM_CELL(t) = static_cast<Cell>(read());
+            VM_RECORD(VM_CHANGE(VM_CELL(t), old));
+            VM_NEXT();
+        }
+        VM_CASE(OUTPUT)
+        {
+            auto& t = tape[pc->tape];
+            write(static_cast<char>(VM_CELL(t)));
+            VM_NEXT();
+        }
+        VM_CASE(COPY_FROM)
+        {
+            auto& t = tape[pc->tape];
+            auto fromIdx = VM_CELL(t);
+            if (Policy::checks && fromIdx >= tapes.size())
             {
-                const auto& name = instructions.getNameAt(readByte());
-                auto& tape = tapes.at(name);
-                tape.ptr++;
-                break;
+                VM_ERROR();
+                runtimeError("Attempting to copy a value from a tape that does not exist.");
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case OpCode::INPUT:
+            auto& from = tape[fromIdx];
+            if (Policy::profiling) profile.copiedFrom[fromIdx]++;
+            VM_RECORD(VM_CHANGE(VM_CELL(from), VM_CELL(t)));
+            VM_CELL(t) = VM_CELL(from);
+            VM_NEXT();
+        }
+        VM_CASE(ADD)
+        {
+            auto& t = tape[pc->tape];
+            VM_CELL(t) = VM_CELL(t) + pc->operand;
+            VM_RECORD(pc->operand);
+            VM_NEXT();
+        }
+        VM_CASE(MOVE)
+        {
+            auto& t = tape[pc->tape];
+            if (Policy::checks && pc->operand < 0 && t.ptr < static_cast<size_t>(-pc->operand))
             {
-                const auto& name = instructions.getNameAt(readByte());
-                auto& tape = tapes.at(name);
-                tape.values[tape.ptr] = getchar();
-                break;
+                VM_ERROR();
+                moveError(pc->tape, t.ptr, -pc->operand, false);
+                VM_RECORD(-static_cast<int64_t>(t.ptr));
+                t.ptr = 0;
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case OpCode::OUTPUT:
+            if (Policy::checks && t.ptr + pc->operand >= t.size && !t.reach(t.ptr + pc->operand, tapeLimit))
             {
-                const auto& name = instructions.getNameAt(readByte());
-                auto& tape = tapes.at(name);
-                std::cout << tape.values[tape.ptr];
-                break;
+                VM_ERROR();
+                moveError(pc->tape, tapeLimit - 1 - t.ptr, pc->operand, true);
+                VM_RECORD(static_cast<int64_t>(tapeLimit - 1 - t.ptr));
+                t.ptr = tapeLimit - 1;
+                return InterpretResult::RUNTIME_ERROR;
             }
-            case OpCode::COPY_FROM:
+            t.ptr += pc->operand;
+            VM_RECORD(pc->operand);
+            VM_NEXT();
+        }
+        VM_CASE(SET_ZERO)
+        {
+            auto& t = tape[pc->tape];
+            VM_RECORD(VM_CHANGE(0, VM_CELL(t)));
+            VM_CELL(t) = 0;
+            VM_NEXT();
+        }
+        VM_CASE(MUL_ADD)
+        {
+            auto& from = tape[pc->tape];
+            auto value = VM_CELL(from);
+            if (value != 0)
             {
-                const auto& name = instructions.getNameAt(readByte());
-                auto& tape = tapes.at(name);
-                auto fromIdx = tape.values[tape.ptr];
-                if (fromIdx >= instructions.tapeCount())
+                auto& to = tape[pc->other];
+                if (Policy::checks && to.ptr + pc->offset >= to.size && !to.reach(to.ptr + pc->offset, tapeLimit))
                 {
-                    runtimeError("Attempting to copy a value from a tape that does not exist.");
+                    // The loop this came from would have walked off the
+                    // end in its body, at the move into the first cell
+                    // past it.
+                    VM_ERROR();
+                    moveError(pc->other, tapeLimit - 1 - to.ptr, pc->offset, true);
                     return InterpretResult::RUNTIME_ERROR;
                 }
-                else
-                {
-                    auto& fromTape = tapes.at(instructions.getNameAt(fromIdx));
-                    tape.values[tape.ptr] = fromTape.values[fromTape.ptr];
-                }
-                break;
+                auto& cell = to.template cells<Cell>()[to.ptr + pc->offset];
+                cell = cell + value * pc->operand;
+                VM_RECORD(VM_CHANGE(value * pc->operand, 0));
             }
+            VM_NEXT();
+        }
+        VM_CASE(SCAN)
+        {
+            auto& t = tape[pc->tape];
+            auto from = t.ptr;
+            if (!scan<Cell>(t, pc->operand))
+            {
+                VM_ERROR();
+                scanError(pc->tape, pc->operand);
+                VM_RECORD(static_cast<int64_t>(t.ptr - from));
+                return InterpretResult::RUNTIME_ERROR;
+            }
+            VM_RECORD(static_cast<int64_t>(t.ptr - from));
+            if (Policy::profiling) profile.scanned[pc - start] += t.ptr > from ? t.ptr - from : from - t.ptr;
+            VM_NEXT();
+        }
+        // The Analyzer proved these can't fail.
+        VM_CASE(INCPTR_UNCHECKED)
+        {
+            tape[pc->tape].ptr++;
+            VM_RECORD(1);
+            VM_NEXT();
+        }
+        VM_CASE(DECPTR_UNCHECKED)
+        {
+            tape[pc->tape].ptr--;
+            VM_RECORD(-1);
+            VM_NEXT();
+        }
+        VM_CASE(MOVE_UNCHECKED)
+        {
+            tape[pc->tape].ptr += pc->operand;
+            VM_RECORD(pc->operand);
+            VM_NEXT();
+        }
+        VM_CASE(COPY_FROM_UNCHECKED)
+        {
+            auto& t = tape[pc->tape];
+            auto fromIdx = VM_CELL(t);
+            auto& from = tape[fromIdx];
+            if (Policy::profiling) profile.copiedFrom[fromIdx]++;
+            VM_RECORD(VM_CHANGE(VM_CELL(from), VM_CELL(t)));
+            VM_CELL(t) = VM_CELL(from);
+            VM_NEXT();
+        }
+        VM_CASE(MUL_ADD_UNCHECKED)
+        {
+            auto& from = tape[pc->tape];
+            auto& to = tape[pc->other];
+            auto& cell = to.template cells<Cell>()[to.ptr + pc->offset];
+            cell = cell + VM_CELL(from) * pc->operand;
+            VM_RECORD(VM_CHANGE(VM_CELL(from) * pc->operand, 0));
+            VM_NEXT();
+        }
+        VM_CASE(HALT)
+        {
+            ip = static_cast<unsigned>(pc - start);
+            flush();
+            return InterpretResult::OK;
         }
     }
-    return InterpretResult::OK;
+
+#undef VM_STEP
+#undef VM_RECORD
+#undef VM_CELL
+#undef VM_CHANGE
+#undef VM_DISPATCH
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+#undef VM_ERROR
 }
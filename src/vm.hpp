@@ -1,34 +1,186 @@
 #pragma once
 
+#include "arena.hpp"
 #include "instruction.hpp"
+#include "jit.hpp"
+#include "profiler.hpp"
+#include "tape_kernels.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
 #include <vector>
-#include <unordered_map>
 #include <string>
+#include <string_view>
 
 enum class InterpretResult
 {
     OK,
     COMPILE_ERROR,
     RUNTIME_ERROR,
+    LIMIT_REACHED,
+    SUSPENDED,      // Only when resumable; run() again carries on.
 };
 
+class TraceWriter;
+
+const size_t OUTPUT_BUFFER_SIZE = 1 << 16;
+const size_t INPUT_BUFFER_SIZE = 1 << 16;
+
+const size_t DEFAULT_TAPE_LIMIT = 30000;
+const int DEFAULT_CELL_BITS = 8;
+
+// With a time limit, the clock is read after about this many instructions.
+const int64_t CLOCK_CHECK_INTERVAL = 1 << 16;
+const size_t TAPE_INITIAL_SIZE = 256;
+
+// Cells are only handed out up to the furthest one the pointer has
+// reached; everything past size is implicitly zero. Until its player
+// joins, and again once they leave, a tape is parked on a single cell of
+// its own, so reading or copying from it costs nothing. The cells are as
+// wide as the arena's, and cells() reads them as the VM's cell type.
 struct Tape
 {
-    std::vector<char> values;
+    char* values;
+    size_t size;        // In cells.
     size_t ptr;
-    Tape(): values(std::vector<char>(30000)), ptr(0) {};
+    TapeArena* arena;
+    char* parked;
+    Tape(TapeArena& arena): values(arena.allocate(1)), size(1), ptr(0), arena(&arena), parked(values) {};
+
+    template <typename Cell> Cell* cells() const { return reinterpret_cast<Cell*>(values); };
+    bool reach(size_t index, size_t limit);
+    void join(size_t cells);
+    void leave();
+};
+
+// What one instance of the dispatch loop does besides run the program,
+// each combination run() can pick compiled on its own, so none of them
+// tests the options the others are for at run time.
+//   Checks     Pointer moves and copies that might fail are tested first.
+//   Limits     Loops going round count down the fuel and time limits.
+//   Profiling  See setProfiling().
+//   Tracing    See setTrace().
+template <bool Checks, bool Limits, bool Profiling = false, bool Tracing = false>
+struct RunPolicy
+{
+    static const bool checks = Checks;
+    static const bool limits = Limits;
+    static const bool profiling = Profiling;
+    static const bool tracing = Tracing;
 };
 
 class VM
 {
 private:
-    Instructions& instructions;
+    const Instructions& instructions;
+    Instructions* writable;     // Null when running a program prepared elsewhere.
+
+    // Decoded here from whatever compile() adds, or shared read-only with
+    // every other VM running the same prepared program.
+    std::vector<DecodedInstruction> ownProgram;
+    const std::vector<DecodedInstruction>* program;
+    int decoded;
+    bool fromStart;             // ownProgram was analyzed from blank tapes.
+    bool rewound;               // Blank tapes since the last decode().
     unsigned ip;
-    std::unordered_map<std::string, Tape> tapes;
+    TapeArena arena;
+    std::vector<Tape> tapes;
+    size_t tapeLimit;
+    int cellBits;
+    bool unchecked;
+    bool analyzing;
+    const TapeKernels& kernels;
+    bool jit;
+    std::vector<JitTape> jitTapes;
+    bool unbuffered;
+    std::ostream* out;
+    std::ostream* errors;
+    std::istream* in;
+    std::string output;
+    std::vector<char> input;
+    size_t inputPos;
+    bool profiling;
+    ProfileCounters profile;
+    TraceWriter* trace;
+
+    // Limits on each call to run(), counted at loop back-edges only. The
+    // dispatch loop just counts down what it was granted and calls
+    // refuel() when that runs out.
+    uint64_t fuel;                  // Instructions, 0 for no limit.
+    std::chrono::nanoseconds timeLimit;
+    bool resumable;
+    uint64_t spent;
+    int64_t granted;
+    std::chrono::steady_clock::time_point deadline;
+
+    void write(char c);
+    int read();
+    void flush();
+
+    template <typename Cell> bool scan(Tape& tape, int stride);
+    void mirror(int slot);
 
+    void decode();
+    size_t joinedSize() const { return unchecked ? tapeLimit : std::min(tapeLimit, TAPE_INITIAL_SIZE); };
+    bool limited() const { return fuel != 0 || timeLimit.count() != 0; };
+    void grant();
+    int64_t refuel(int64_t budget);
+    InterpretResult limitReached(unsigned end);
+    bool runCompiled();
+    template <typename Policy> InterpretResult executeCells();
+    template <typename Cell, typename Policy> InterpretResult execute();
+    int lineOf(const DecodedInstruction& instruction) const;
     void runtimeError(const char* format, ...);
+    void runtimeErrorAt(int line, const char* format, ...);
+    void moveError(int slot, size_t moves, int count, bool right);
+    void scanError(int slot, int stride);
+
+    VM(const Instructions& i, Instructions* writable, const std::vector<DecodedInstruction>* shared): instructions(i), writable(writable), ownProgram(std::vector<DecodedInstruction>()),
+        program(shared != nullptr ? shared : &ownProgram), decoded(shared != nullptr ? i.codeCount() : 0), fromStart(false), rewound(true), ip(0), tapes(std::vector<Tape>()), tapeLimit(DEFAULT_TAPE_LIMIT), cellBits(DEFAULT_CELL_BITS), unchecked(false), analyzing(true), kernels(tapeKernels()), jit(false), jitTapes(std::vector<JitTape>()),
+        unbuffered(false), out(&std::cout), errors(&std::cerr), in(&std::cin), output(std::string()), input(std::vector<char>()), inputPos(0), profiling(false), profile(ProfileCounters()), trace(nullptr),
+        fuel(0), timeLimit(0), resumable(false), spent(0), granted(0) {};
 public:
-    VM(Instructions& i): instructions(i), ip(0), tapes(std::unordered_map<std::string, Tape>()) {};
-    InterpretResult interpret(const std::string& source);
+    VM(Instructions& i): VM(i, &i, nullptr) {};
+    // Runs 'program', as returned by prepare(), without copying it. Such a
+    // VM can't compile anything more.
+    VM(const Instructions& i, const std::vector<DecodedInstruction>& program): VM(i, nullptr, &program) {};
+    VM(const VM&) = delete;
+    VM& operator=(const VM&) = delete;
+
+    static std::vector<DecodedInstruction> prepare(const Instructions& instructions);
+
+    void setJit(bool enabled) { jit = enabled && Jit::supported(); };
+    void setUnbuffered(bool enabled) { unbuffered = enabled; };
+    // Every tape has the cell its pointer starts on, so never less than 1.
+    void setTapeLimit(size_t limit) { tapeLimit = std::max<size_t>(limit, 1); fromStart = false; };
+    // Cells of 8, 16 or 32 bits, wrapping around at that width. Only
+    // before anything is compiled or run. Compiled code only has 8-bit
+    // cells, so wider ones always interpret.
+    void setCellBits(int bits) { cellBits = bits; arena.setCellSize(bits / 8); };
+    int getCellBits() const { return cellBits; };
+    // Leaves out every check a pointer move or copy would make. A script
+    // that does go wrong can then do anything, so this is for trusted ones
+    // only. Profiling and tracing always check.
+    void setUnchecked(bool enabled) { unchecked = enabled; fromStart = false; };
+    // Without the analysis every pointer move and copy keeps its check,
+    // which is what the analysis gets tested against.
+    void setAnalyzing(bool enabled) { analyzing = enabled; fromStart = false; };
+    void setOutput(std::ostream& stream) { out = &stream; };
+    void setErrors(std::ostream& stream) { errors = &stream; };
+    void setInput(std::istream* stream) { in = stream; };
+    void setProfiling(bool enabled) { profiling = enabled; };
+    // Records every change to a tape into 'writer' from the next run()
+    // on. Null stops recording.
+    void setTrace(TraceWriter* writer) { trace = writer; };
+    void setFuel(uint64_t instructions) { fuel = instructions; };
+    void setTimeLimit(std::chrono::nanoseconds limit) { timeLimit = limit; };
+    void setResumable(bool enabled) { resumable = enabled; };
+    const ProfileCounters& getProfile() const { return profile; };
+    const std::vector<DecodedInstruction>& getProgram() const { return *program; };
+    bool compile(std::string_view source);
+    InterpretResult interpret(std::string_view source);
     InterpretResult run();
+    void reset();
+    void discard();
 };
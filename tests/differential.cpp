@@ -0,0 +1,423 @@
+#include "instruction.hpp"
+#include "parser.hpp"
+#include "vm.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <vector>
+
+// Runs generated scripts every way quickchat can run them: interpreted,
+// with --jit, as C from --emit-c, --unchecked, and with each --cell-bits.
+// Each has to print the same output and errors and exit with the same
+// status as the reference, which is the script just as the parser wrote
+// it, unoptimized and with every check the analysis would drop still in,
+// in the interpreter. A script that goes wrong is kept as
+// differential_<n>.qc for a closer look.
+//
+// Usage: quickchat-differential <quickchat> [cc] [--scripts N] [--seed N]
+// Without a C compiler the emitted C isn't tried.
+
+static const char* SCRIPT_PATH = "differential.qc";
+static const char* INPUT_PATH = "differential.input";
+static const char* C_PATH = "differential.c";
+static const char* BINARY_PATH = "./differential.bin";
+static const char* OUTPUT_PATH = "differential.out";
+static const char* ERRORS_PATH = "differential.err";
+
+// Scripts that don't finish within this much fuel, which is most of those
+// counting down from zero in wide cells, are only run at the widths where
+// they do.
+static const uint64_t FUEL = 1 << 20;
+
+static const int CPU_SECONDS = 10;
+
+static const size_t TAPE_LIMITS[] = { 3, 8, DEFAULT_TAPE_LIMIT };
+
+// Scripts that once came out differently, each with the tape limit that
+// shows it.
+struct Regression
+{
+    size_t tapeLimit;
+    const char* script;
+};
+
+static const Regression REGRESSIONS[] = {
+    // A folded loop that moves ALPHA further than it adds to it, here not
+    // at all, ran off the end of ALPHA's tape without an error.
+    { 3,
+        "Alpha joined the match\n"
+        "Bravo joined the match\n"
+        "BRAVO: Nice shot!\n"
+        "BRAVO: Take the shot!\n"
+        "BRAVO: No problem.\n"
+        "ALPHA: I got it!\n"
+        "ALPHA: I got it!\n"
+        "ALPHA: I got it!\n"
+        "ALPHA: Defending...\n"
+        "ALPHA: Defending...\n"
+        "ALPHA: Defending...\n"
+        "BRAVO: What a save!\n" },
+};
+
+struct Outcome
+{
+    int status;
+    std::string output;
+    std::string errors;
+};
+
+struct Mode
+{
+    const char* flags;
+    int cellBits;
+    bool unchecked;     // Only has to match up to a runtime error.
+};
+
+static const Mode MODES[] = {
+    { "", 8, false },
+    { "--jit", 8, false },
+    { "--unchecked", 8, true },
+    { "--jit --unchecked", 8, true },
+    { "--cell-bits 16", 16, false },
+    { "--cell-bits 16 --unchecked", 16, true },
+    { "--cell-bits 32", 32, false },
+    { "--cell-bits 32 --unchecked", 32, true },
+};
+
+static std::string line(const std::string& name, const std::string& command)
+{
+    return name + ": " + command + "\n";
+}
+
+// Scripts of a few players, some of whom join and leave along the way,
+// with loops the optimizer can fold into arithmetic and loops it can't.
+// Pointers wander far enough right that the small tape limits get hit.
+class Generator
+{
+private:
+    std::mt19937 random;
+    std::vector<std::string> players;
+    std::vector<std::string> extras;
+    std::vector<bool> joined;
+    std::string source;
+
+    int pick(int n) { return random() % n; };
+    bool chance(int percent) { return pick(100) < percent; };
+
+    std::string anyone()
+    {
+        std::vector<std::string> present = players;
+        for (size_t i = 0; i < extras.size(); i++)
+        {
+            if (joined[i]) present.push_back(extras[i]);
+        }
+        return present[pick(present.size())];
+    }
+
+    void repeat(const std::string& name, const std::string& command, int times)
+    {
+        for (int i = 0; i < times; i++) source += line(name, command);
+    }
+
+    void command()
+    {
+        static const char* commands[] = {
+            "Nice shot!", "Nice shot!", "No problem.", "No problem.", "I got it!", "Defending...",
+            "Calculated.", "Calculated.", "Great pass!", "Incoming!",
+        };
+        std::string command = commands[pick(10)];
+        auto times = command == "Nice shot!" || command == "No problem." ? 1 + pick(chance(10) ? 300 : 3) : 1;
+        repeat(anyone(), command, times);
+    }
+
+    void joinOrLeave()
+    {
+        auto extra = pick(extras.size());
+        source += extras[extra] + (joined[extra] ? " left the match\n" : " joined the match\n");
+        joined[extra] = !joined[extra];
+    }
+
+    // Adds to cells and moves pointers about, putting every pointer back
+    // where it was, so the whole loop becomes MUL_ADDs. Some pointers go
+    // further right than any cell added to, and some tapes only move.
+    void linearLoop()
+    {
+        auto counter = anyone();
+        repeat(counter, "Nice shot!", 1 + pick(3));
+        source += line(counter, "Take the shot!");
+        repeat(counter, "No problem.", chance(75) ? 1 : 3);
+
+        std::vector<std::pair<std::string, int>> moved;
+        for (int steps = pick(4); steps >= 0; steps--)
+        {
+            auto name = anyone();
+            auto right = pick(4);
+            repeat(name, "I got it!", right);
+            repeat(name, chance(50) ? "Nice shot!" : "No problem.", pick(3));
+            moved.push_back({ name, right });
+        }
+        while (!moved.empty())
+        {
+            auto back = moved.begin() + pick(moved.size());
+            repeat(back->first, "Defending...", back->second);
+            moved.erase(back);
+        }
+        source += line(counter, "What a save!");
+    }
+
+    void loop(int depth)
+    {
+        auto name = anyone();
+        source += line(name, "Take the shot!");
+        source += line(name, "No problem.");
+        body(depth + 1, 1 + pick(6));
+        // Anyone who left in the body takes the loop with them, which is
+        // a compile error worth checking too.
+        source += line(name, "What a save!");
+    }
+
+    void body(int depth, int statements)
+    {
+        for (int i = 0; i < statements; i++)
+        {
+            auto kind = pick(100);
+            if (kind < 8) joinOrLeave();
+            else if (kind < 20 && depth < 3) linearLoop();
+            else if (kind < 30 && depth < 3) loop(depth);
+            else command();
+        }
+    }
+public:
+    Generator(unsigned seed): random(seed) {};
+
+    std::string script()
+    {
+        static const char* names[] = { "ALPHA", "BRAVO", "CHARLIE" };
+        players.assign(names, names + 1 + pick(3));
+        extras = { "DELTA", "ECHO" };
+        joined.assign(extras.size(), false);
+        source.clear();
+        for (auto& name : players)
+        {
+            source += name + " joined the match\n";
+        }
+        body(0, 5 + pick(36));
+        return source;
+    }
+
+    std::string input()
+    {
+        std::string bytes;
+        for (int i = pick(9); i > 0; i--) bytes += static_cast<char>(pick(256));
+        return bytes;
+    }
+};
+
+static std::string readFile(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+static void writeFile(const std::string& path, const std::string& contents)
+{
+    std::ofstream file(path, std::ios::binary);
+    file << contents;
+}
+
+// The exit status a shell command ended with, or -1 if it didn't exit.
+static int shell(const std::string& command)
+{
+    auto status = std::system(command.c_str());
+    return status != -1 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Runs 'command' on the input, collecting what it prints. Every script
+// the reference finishes runs in well under a second, so one that takes
+// much longer has gone wrong and is stopped.
+static Outcome execute(const std::string& command)
+{
+    auto status = shell("ulimit -t " + std::to_string(CPU_SECONDS) + "; " + command + " < " + INPUT_PATH + " > " + OUTPUT_PATH + " 2> " + ERRORS_PATH);
+    return { status, readFile(OUTPUT_PATH), readFile(ERRORS_PATH) };
+}
+
+// What the unoptimized, unanalyzed script does, with the same exit status
+// the command line would give. False if it runs out of fuel.
+static bool reference(const std::string& script, const std::string& input, size_t tapeLimit, int cellBits, Outcome& outcome)
+{
+    auto instructions = Instructions();
+    auto vm = VM(instructions);
+    std::ostringstream output;
+    std::ostringstream errors;
+    std::istringstream in(input);
+    vm.setCellBits(cellBits);
+    vm.setTapeLimit(tapeLimit);
+    vm.setAnalyzing(false);
+    vm.setFuel(FUEL);
+    vm.setOutput(output);
+    vm.setErrors(errors);
+    vm.setInput(&in);
+
+    auto result = InterpretResult::COMPILE_ERROR;
+    if (Parser(script, instructions, errors).compile()) result = vm.run();
+    if (result == InterpretResult::LIMIT_REACHED) return false;
+
+    outcome = { result == InterpretResult::OK ? 0 : result == InterpretResult::COMPILE_ERROR ? 65 : 70, output.str(), errors.str() };
+    return true;
+}
+
+class Checker
+{
+private:
+    std::string quickchat;
+    std::string cc;
+    int failures;
+    int comparisons;
+
+    void compare(const std::string& mode, const std::string& script, const Outcome& expected, const Outcome& actual)
+    {
+        comparisons++;
+        if (actual.status == expected.status && actual.output == expected.output && actual.errors == expected.errors) return;
+        fail(mode, script, expected, actual);
+    }
+
+    // Unchecked code that goes wrong may do anything after, but up to
+    // there it has to print what the reference did.
+    void compareUntilError(const std::string& mode, const std::string& script, const Outcome& expected, const Outcome& actual)
+    {
+        comparisons++;
+        if (actual.output.compare(0, expected.output.size(), expected.output) == 0) return;
+        fail(mode, script, expected, actual);
+    }
+
+    void fail(const std::string& mode, const std::string& script, const Outcome& expected, const Outcome& actual)
+    {
+        failures++;
+        auto path = "differential_" + std::to_string(failures) + ".qc";
+        writeFile(path, script);
+        std::cerr << path << " " << mode << ": exited " << actual.status << ", expected " << expected.status << std::endl;
+        if (actual.output != expected.output) std::cerr << "  output differs" << std::endl;
+        if (actual.errors != expected.errors)
+        {
+            std::cerr << "  errors:" << std::endl << actual.errors << "  expected:" << std::endl << expected.errors;
+        }
+    }
+
+    void emitted(const std::string& script, const std::string& limit, const Outcome& expected)
+    {
+        auto emit = execute(quickchat + " --no-cache " + limit + " --emit-c " + SCRIPT_PATH);
+        if (emit.status != 0)
+        {
+            compare("--emit-c", script, expected, emit);
+            return;
+        }
+        writeFile(C_PATH, emit.output);
+        if (shell(cc + " -o " + BINARY_PATH + " " + C_PATH) != 0)
+        {
+            compare("--emit-c (didn't compile)", script, expected, { -1, "", "" });
+            return;
+        }
+        compare("--emit-c", script, expected, execute(BINARY_PATH));
+    }
+public:
+    Checker(const std::string& quickchat, const std::string& cc): quickchat("\"" + quickchat + "\""), cc(cc.empty() ? cc : "\"" + cc + "\""), failures(0), comparisons(0) {};
+
+    int getFailures() const { return failures; };
+    int getComparisons() const { return comparisons; };
+
+    void check(const std::string& script, const std::string& input, size_t tapeLimit)
+    {
+        writeFile(SCRIPT_PATH, script);
+        writeFile(INPUT_PATH, input);
+        auto limit = "--tape-limit " + std::to_string(tapeLimit);
+
+        std::map<int, Outcome> expected;
+        for (int bits : { 8, 16, 32 })
+        {
+            Outcome outcome;
+            if (reference(script, input, tapeLimit, bits, outcome)) expected[bits] = outcome;
+        }
+
+        for (auto& mode : MODES)
+        {
+            auto found = expected.find(mode.cellBits);
+            if (found == expected.end()) continue;
+            auto flags = std::string(mode.flags);
+            auto command = quickchat + " --no-cache " + limit + " " + flags;
+            if (mode.unchecked && found->second.status == 70)
+            {
+                // Unbuffered so a crash doesn't lose what came before it,
+                // and with fuel in case it goes round for ever instead.
+                auto actual = execute(command + " --unbuffered --fuel " + std::to_string(FUEL) + " " + SCRIPT_PATH);
+                compareUntilError(flags, script, found->second, actual);
+                continue;
+            }
+            compare(flags.empty() ? "interpreted" : flags, script, found->second, execute(command + " " + SCRIPT_PATH));
+        }
+        if (expected.count(8) != 0 && !cc.empty()) emitted(script, limit, expected[8]);
+    }
+};
+
+static void usage()
+{
+    std::cerr << "Usage: quickchat-differential <quickchat> [cc] [--scripts N] [--seed N]" << std::endl;
+    exit(64);
+}
+
+int main(int argc, const char* argv[])
+{
+    int scripts = 150;
+    unsigned seed = 1;
+    std::vector<std::string> tools;
+
+    for (int i = 1; i < argc; i++)
+    {
+        auto arg = std::string(argv[i]);
+        if (arg == "--scripts" && i + 1 < argc)
+        {
+            scripts = atoi(argv[++i]);
+            if (scripts <= 0) usage();
+        }
+        else if (arg == "--seed" && i + 1 < argc)
+        {
+            seed = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg.rfind("--", 0) != 0 && tools.size() < 2)
+        {
+            tools.push_back(arg);
+        }
+        else
+        {
+            usage();
+        }
+    }
+    if (tools.empty()) usage();
+
+    auto checker = Checker(tools[0], tools.size() > 1 ? tools[1] : "");
+    for (auto& regression : REGRESSIONS)
+    {
+        checker.check(regression.script, "", regression.tapeLimit);
+    }
+
+    auto generator = Generator(seed);
+    for (int i = 0; i < scripts; i++)
+    {
+        auto script = generator.script();
+        auto input = generator.input();
+        checker.check(script, input, TAPE_LIMITS[i % 3]);
+    }
+
+    for (auto path : { SCRIPT_PATH, INPUT_PATH, C_PATH, BINARY_PATH, OUTPUT_PATH, ERRORS_PATH })
+    {
+        remove(path);
+    }
+    std::cerr << checker.getComparisons() << " runs compared, " << checker.getFailures() << " differed" << std::endl;
+    return checker.getFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+#include "quickchat.hpp"
+#include <iostream>
+#include <string>
+
+// Runs scripts through the embedding API and checks what the settings on
+// an Execution do to them.
+//
+// Usage: quickchat-library-test
+
+static int failures = 0;
+
+static void expect(bool condition, const std::string& what)
+{
+    if (condition) return;
+    failures++;
+    std::cerr << "failed: " << what << std::endl;
+}
+
+// A tape limit of 0 is taken as 1, so the cell a pointer starts on is
+// still there, and the first move right is past the end.
+static void zeroTapeLimit()
+{
+    auto program = Program::compile("A joined the match\nA: Nice shot!\nA: Nice shot!\nA: Calculated.\n");
+    auto execution = Execution(program);
+    execution.setTapeLimit(0);
+    expect(execution.run() == RunResult::OK, "tape limit 0 runs like 1");
+    expect(execution.output() == std::string(1, '\2'), "tape limit 0 keeps the first cell");
+
+    auto moving = Program::compile("A joined the match\nA: I got it!\n");
+    auto moved = Execution(moving);
+    moved.setTapeLimit(0);
+    expect(moved.run() == RunResult::RUNTIME_ERROR, "tape limit 0 stops the first move right");
+    expect(moved.errors() == "Attempting to increment the pointer past the end of A.\n[line 2] in script\n",
+        "tape limit 0 names the move past the end");
+}
+
+int main()
+{
+    zeroTapeLimit();
+    std::cerr << failures << " failed" << std::endl;
+    return failures == 0 ? 0 : 1;
+}